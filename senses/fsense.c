@@ -4,7 +4,8 @@
  * Reference: http://senseye.arcan-fe.com
  * Description: mmaps a file and implements a preview- window and a main
  * data channel that build on the rwstats statistics code along with the
- * senseye arcan shmif wrapper.
+ * senseye arcan shmif wrapper. Given a second file, the data channel
+ * shows the XOR of the two and the preview where they differ.
  */
 
 #include <stdlib.h>
@@ -27,19 +28,51 @@
 #include <sys/stat.h>
 #include <sys/resource.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "senseye.h"
 #include "rwstat.h"
+#include "fsense_index.h"
 
 struct {
 	uint8_t* fmap;
+/* guards the published search hits, see search below */
 	pthread_mutex_t flock;
 	struct senseye_cont* cont;
 	size_t fmap_sz;
-	size_t ofs;
 	size_t bytes_perline;
 
+/* window offset, only touched by the data thread */
+	size_t ofs;
+
+/* hit last stepped to and the window that was clamped to, so that
+ * hits in the last window can still be stepped through one by one */
+	size_t hit_ofs, hit_win;
+	bool hit_set;
+
+/* latest offset requested from the control segment, published by
+ * bumping seek_gen. seek_wake is set while a wakeup is pending so that
+ * a burst of seeks costs one write to pipe_out and one frame */
+	size_t seek_ofs;
+	uint64_t seek_gen;
+	bool seek_wake;
+
+/* budget for built frames kept around for stepping back and forth */
+	size_t cache_sz;
+
 	int pipe_in;
 	int pipe_out;
+
+/* optional block statistics, see fsense_index.h */
+	struct fsidx* idx;
+
+/* diff mode, second file that windows are XORed against (fmap_sz is
+ * the shorter of the two) into wbuf, which the channel borrows */
+	uint8_t* dmap;
+	uint8_t* wbuf;
+	size_t wbuf_sz;
 } fsense = {0};
 
 /*
@@ -53,10 +86,11 @@ void control_event(struct senseye_cont* cont, arcan_event* ev)
 	if (ev->category == EVENT_TARGET){
 		switch(ev->tgt.kind){
 		case TARGET_COMMAND_SEEKTIME:
-			pthread_mutex_lock(&fsense.flock);
-			fsense.ofs = fsense.bytes_perline * ev->tgt.ioevs[1].iv;
-			pthread_mutex_unlock(&fsense.flock);
-			write(fsense.pipe_out, &nonsense, sizeof(nonsense));
+			__atomic_store_n(&fsense.seek_ofs,
+				fsense.bytes_perline * ev->tgt.ioevs[1].iv, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&fsense.seek_gen, 1, __ATOMIC_SEQ_CST);
+			if (!__atomic_exchange_n(&fsense.seek_wake, true, __ATOMIC_SEQ_CST))
+				write(fsense.pipe_out, &nonsense, sizeof(nonsense));
 		break;
 		default:
 		break;
@@ -64,42 +98,214 @@ void control_event(struct senseye_cont* cont, arcan_event* ev)
 	}
 }
 
+/* advice for the pages that cover [buf, buf+n) */
+static void advise_range(uint8_t* buf, size_t n, int advice)
+{
+	uintptr_t pmask = sysconf(_SC_PAGESIZE) - 1;
+	uintptr_t start = (uintptr_t) buf & ~pmask;
+	madvise((void*) start, (uintptr_t) buf + n - start, advice);
+}
+
+/*
+ * Prefetching follows the window as it is stepped or seeked. The rate of
+ * movement (bytes per second, smoothed) decides how far ahead in the
+ * current direction to request pages, and the span that has been touched
+ * is bounded so that pages far behind the window are dropped again.
+ */
+static struct {
+	size_t last;
+	unsigned long long last_ts;
+	float rate;
+	int dir;
+
+/* span that may be resident because of stepping or prefetching */
+	size_t lo, hi;
+} pf;
+
+/* look-ahead horizon, lower and upper bounds in windows */
+static const float pf_horizon_s = 0.5f;
+static const size_t pf_min_ahead = 1;
+static const size_t pf_max_ahead = 16;
+
+/* windows kept resident around the current one */
+static const size_t pf_keep = 64;
+
+/* same advice for both files in diff mode */
+static void advise_window(size_t ofs, size_t n, int advice)
+{
+	advise_range(fsense.fmap + ofs, n, advice);
+	if (fsense.dmap)
+		advise_range(fsense.dmap + ofs, n, advice);
+}
+
+static void pf_drop(size_t lo, size_t hi)
+{
+	if (hi > lo)
+		advise_window(lo, hi - lo, MADV_DONTNEED);
+}
+
+static void prefetch(size_t ofs, size_t bsz)
+{
+	unsigned long long ts = arcan_timemillis();
+	size_t delta = ofs > pf.last ? ofs - pf.last : pf.last - ofs;
+	size_t keep = pf_keep * bsz;
+
+	if (ofs != pf.last)
+		pf.dir = ofs > pf.last ? 1 : -1;
+
+/* long seek, nothing of the old span is near */
+	if (delta > keep || pf.hi == 0){
+		pf_drop(pf.lo, pf.hi);
+		pf.lo = ofs;
+		pf.hi = ofs + bsz;
+		pf.rate = 0.0f;
+	}
+	else {
+		float dt = (float)(ts - pf.last_ts) / 1000.0f;
+		float cur = dt > 0.001f ? (float) delta / dt : (float) delta * 1000.0f;
+		pf.rate = 0.5f * pf.rate + 0.5f * cur;
+	}
+
+	pf.last = ofs;
+	pf.last_ts = ts;
+
+	size_t ahead = pf.rate * pf_horizon_s;
+	if (ahead < pf_min_ahead * bsz)
+		ahead = pf_min_ahead * bsz;
+	if (ahead > pf_max_ahead * bsz)
+		ahead = pf_max_ahead * bsz;
+
+	size_t lo, hi;
+	if (pf.dir >= 0){
+		lo = ofs + bsz;
+		hi = lo + ahead;
+	}
+	else {
+		hi = ofs;
+		lo = ofs > ahead ? ofs - ahead : 0;
+	}
+
+	lo = lo > fsense.fmap_sz ? fsense.fmap_sz : lo;
+	hi = hi > fsense.fmap_sz ? fsense.fmap_sz : hi;
+	if (hi > lo)
+		advise_window(lo, hi - lo, MADV_WILLNEED);
+
+	pf.lo = lo < pf.lo ? lo : pf.lo;
+	pf.hi = hi > pf.hi ? hi : pf.hi;
+	pf.lo = ofs < pf.lo ? ofs : pf.lo;
+	pf.hi = ofs + bsz > pf.hi ? ofs + bsz : pf.hi;
+
+/* trim what is behind the direction of travel */
+	if (pf.hi - pf.lo > keep){
+		if (pf.dir >= 0){
+			pf_drop(pf.lo, pf.hi - keep);
+			pf.lo = pf.hi - keep;
+		}
+		else {
+			pf_drop(pf.lo + keep, pf.hi);
+			pf.hi = pf.lo + keep;
+		}
+	}
+}
+
+/*
+ * precomputed entropy (0..1) for a window if the index is ready,
+ * carried as the frame hint alongside the position of the window
+ */
+static float window_entropy(size_t ofs, size_t len)
+{
+	struct fsidx_ent ent;
+	if (fsidx_stats(fsense.idx, ofs, len, &ent))
+		return (float) ent.ent / 255.0f;
+	return 0.0f;
+}
+
+static void diff_xor(uint8_t* dst, const uint8_t* a, const uint8_t* b, size_t n)
+{
+	size_t i = 0;
+#if defined(__SSE2__)
+	for (; i + 64 <= n; i += 64)
+		for (size_t j = 0; j < 64; j += 16){
+			__m128i va = _mm_loadu_si128((const __m128i*) &a[i + j]);
+			__m128i vb = _mm_loadu_si128((const __m128i*) &b[i + j]);
+			_mm_storeu_si128((__m128i*) &dst[i + j], _mm_xor_si128(va, vb));
+		}
+#endif
+	for (; i + 8 <= n; i += 8){
+		uint64_t va, vb;
+		memcpy(&va, &a[i], 8);
+		memcpy(&vb, &b[i], 8);
+		va ^= vb;
+		memcpy(&dst[i], &va, 8);
+	}
+
+	for (; i < n; i++)
+		dst[i] = a[i] ^ b[i];
+}
+
+/*
+ * the bytes to feed the channel for [ofs, ofs+n), either the file itself
+ * or in diff mode, the XOR of both files (valid until the next call)
+ */
+static uint8_t* window_src(size_t ofs, size_t n)
+{
+	if (!fsense.dmap)
+		return fsense.fmap + ofs;
+
+	if (n > fsense.wbuf_sz){
+		uint8_t* buf = realloc(fsense.wbuf, n);
+		if (!buf){
+			fprintf(stderr, "fsense:window_src(), couldn't grow diff buffer "
+				"to %zu bytes, showing the first file\n", n);
+			return fsense.fmap + ofs;
+		}
+		fsense.wbuf = buf;
+		fsense.wbuf_sz = n;
+	}
+
+	diff_xor(fsense.wbuf, fsense.fmap + ofs, fsense.dmap + ofs, n);
+	return fsense.wbuf;
+}
+
 /*
  * invoked whenever the ofset has been changed from the primary segment
  */
 static uint8_t bss_block[1024];
-static void force_refresh(struct rwstat_ch* ch)
+static void force_refresh(struct rwstat_ch* ch, size_t lofs)
 {
 	int ign;
-	size_t lofs;
 
 	size_t nb = ch->row_size(ch);
 	size_t bsz = nb * ch->context(ch)->addr->h;
 
-	pthread_mutex_lock(&fsense.flock);
-	if (fsense.ofs > fsense.fmap_sz - bsz)
-		fsense.ofs = fsense.fmap_sz - bsz;
-	lofs = fsense.ofs;
-	pthread_mutex_unlock(&fsense.flock);
+	if (lofs > fsense.fmap_sz - bsz)
+		lofs = fsense.fmap_sz - bsz;
+	fsense.ofs = lofs;
 
 	size_t left = ch->left(ch);
 	if (left > fsense.fmap_sz - lofs){
-		ch->data(ch, fsense.fmap, fsense.fmap_sz - lofs, &ign);
+		ch->data(ch, window_src(lofs, fsense.fmap_sz - lofs),
+			fsense.fmap_sz - lofs, &ign);
 		while (ign != 1)
 			ch->data(ch, bss_block, 1024, &ign);
 	}
-	else
-		ch->data(ch, fsense.fmap + fsense.ofs, left, &ign);
+	else {
+		ch->cache_key(ch, lofs);
+		ch->borrow(ch, window_src(lofs, left), left, &ign);
+	}
+
+	prefetch(lofs, bsz);
 
 	struct arcan_event outev = {
 		.category = EVENT_EXTERNAL,
 		.ext.kind = EVENT_EXTERNAL_FRAMESTATUS,
 		.ext.framestatus.framenumber = (lofs+1) / fsense.bytes_perline,
-		.ext.framestatus.pts = bsz / fsense.bytes_perline
+		.ext.framestatus.pts = bsz / fsense.bytes_perline,
+		.ext.framestatus.fhint = window_entropy(lofs, bsz)
 	};
 	arcan_shmif_enqueue(fsense.cont->context(fsense.cont), &outev);
 
-	ch->wind_ofs(ch, fsense.ofs);
+	ch->wind_ofs(ch, lofs);
 }
 
 static void refresh_data(struct rwstat_ch* ch, size_t pos, size_t ntw)
@@ -108,13 +314,82 @@ static void refresh_data(struct rwstat_ch* ch, size_t pos, size_t ntw)
 		.category = EVENT_EXTERNAL,
 		.ext.kind = EVENT_EXTERNAL_FRAMESTATUS,
 		.ext.framestatus.framenumber = (pos + 1) / fsense.bytes_perline,
-		.ext.framestatus.pts = ntw / fsense.bytes_perline
+		.ext.framestatus.pts = ntw / fsense.bytes_perline,
+		.ext.framestatus.fhint = window_entropy(pos, ntw)
 	};
 
 	arcan_shmif_enqueue(fsense.cont->context(fsense.cont), &outev);
 	int ign;
 	ch->wind_ofs(ch, pos);
-	ch->data(ch, fsense.fmap + pos, ntw, &ign);
+	ch->cache_key(ch, pos);
+	ch->borrow(ch, window_src(pos, ntw), ntw, &ign);
+	prefetch(pos, ntw);
+}
+
+/*
+ * Whole-file search for the pattern set of the data channel, run after
+ * the preview has been reduced by splitting the (first) file into chunks
+ * between threads. Hits land in per-chunk lists that are joined in file
+ * order so the index comes out sorted, and are marked in the preview.
+ * A chunk keeps at most search_chunk_hits, which bounds the index to a
+ * small fraction of the file size for patterns that match everywhere.
+ */
+#define SEARCH_CHUNK (4 * 1024 * 1024)
+static const size_t search_chunk_hits = 16384;
+
+struct hit_list {
+	size_t base;
+	size_t* ofs;
+	size_t n, cap;
+	bool full;
+};
+
+static struct {
+	struct rwstat_search* set;
+	pthread_mutex_t lock;
+	size_t next, n_chunks;
+	struct hit_list* chunks;
+
+/* sorted match offsets, published under fsense.flock */
+	size_t* hits;
+	size_t n_hits;
+} search = {
+	.lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+/*
+ * move *ofs to the next (dir > 0) or previous hit, fsense.flock held,
+ * false if there is none in that direction
+ */
+static bool seek_hit(int dir, size_t* ofs)
+{
+	size_t lo = 0, hi = search.n_hits;
+
+/* first hit > *ofs */
+	while (lo < hi){
+		size_t mid = lo + (hi - lo) / 2;
+		if (search.hits[mid] <= *ofs)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (dir > 0){
+		if (lo == search.n_hits)
+			return false;
+		*ofs = search.hits[lo];
+		return true;
+	}
+
+/* skip hits at *ofs to get the last that is < *ofs */
+	while (lo > 0 && search.hits[lo - 1] >= *ofs)
+		lo--;
+
+	if (lo == 0)
+		return false;
+
+	*ofs = search.hits[lo - 1];
+	return true;
 }
 
 void* data_loop(void* th_data)
@@ -132,20 +407,31 @@ void* data_loop(void* th_data)
 
 	short pollev = POLLIN | POLLERR | POLLHUP | POLLNVAL;
 	ch->event(ch, &ev);
+
+/* the mapping is read-only so the offset of a window identifies it */
+	ch->frame_cache(ch, fsense.cache_sz);
+	uint64_t seek_gen = 0;
 	while (1){
 		struct pollfd fds[2] = {
 			{	.fd = fsense.pipe_in, .events = pollev },
 			{ .fd = cont->epipe, .events = pollev }
 		};
 
-		int sv = poll(fds, 2, -1);
+		poll(fds, 2, -1);
 
-/* non-blocking, just flush */
-		read(fsense.pipe_in, &sv, 4);
+/* non-blocking, just flush, then re-arm the wakeup before looking at the
+ * request so that a seek arriving after this point writes again */
+		int sv[16];
+		while (read(fsense.pipe_in, sv, sizeof(sv)) > 0)
+			;
+		__atomic_store_n(&fsense.seek_wake, false, __ATOMIC_SEQ_CST);
 
-/* parent marked seek, force step, switch to block mode */
-		if ( (fds[0].revents & POLLIN) )
-			force_refresh(ch);
+/* parent marked seek, only the newest one is worth a frame */
+		uint64_t gen = __atomic_load_n(&fsense.seek_gen, __ATOMIC_SEQ_CST);
+		if (gen != seek_gen){
+			seek_gen = gen;
+			force_refresh(ch, __atomic_load_n(&fsense.seek_ofs, __ATOMIC_RELAXED));
+		}
 
 		arcan_event ev;
 		while (arcan_shmif_poll(cont, &ev) != 0){
@@ -161,8 +447,11 @@ void* data_loop(void* th_data)
 
 			case TARGET_COMMAND_DISPLAYHINT:{
 				size_t base = ev.tgt.ioevs[0].iv;
-				if (base > 0 && (base & (base - 1)) == 0 &&
-					arcan_shmif_resize(cont, base, base)){
+				if (base == 0 || (base & (base - 1)) != 0)
+					break;
+
+				ch->sync(ch);
+				if (arcan_shmif_resize(cont, base, base)){
 					ch->resize(ch, base);
 /* we also need to check ofs against this new block-size,
  * and possible update the hinted number of lines covered
@@ -177,31 +466,24 @@ void* data_loop(void* th_data)
 
 				if (ev.tgt.ioevs[0].iv == -1){
 					ch->switch_clock(ch, RW_CLK_BLOCK);
-					pthread_mutex_lock(&fsense.flock);
 
 					if (fsense.ofs < nb)
 						fsense.ofs = 0;
 					else
 						fsense.ofs -= nb;
-					size_t lofs = fsense.ofs;
-					pthread_mutex_unlock(&fsense.flock);
 
-					refresh_data(ch, lofs, bsz);
+					refresh_data(ch, fsense.ofs, bsz);
 				}
 				else if (ev.tgt.ioevs[0].iv == 1){
 					ch->switch_clock(ch, RW_CLK_BLOCK);
-					pthread_mutex_lock(&fsense.flock);
 					fsense.ofs += nb;
 					if (fsense.ofs + bsz > fsense.fmap_sz)
 						fsense.ofs = fsense.fmap_sz - bsz;
-					size_t lofs = fsense.ofs;
-					pthread_mutex_unlock(&fsense.flock);
 
-					refresh_data(ch, lofs, bsz);
+					refresh_data(ch, fsense.ofs, bsz);
 				}
 				else if (ev.tgt.ioevs[0].iv == -2){
 					ch->switch_clock(ch, RW_CLK_BLOCK);
-					pthread_mutex_lock(&fsense.flock);
 					if (fsense.ofs < bsz)
 						fsense.ofs = 0;
 					else
@@ -211,19 +493,33 @@ void* data_loop(void* th_data)
 					if (lofs + bsz > fsense.fmap_sz)
 						lofs = fsense.fmap_sz - bsz;
 
-					pthread_mutex_unlock(&fsense.flock);
 					refresh_data(ch, lofs, bsz);
 				}
 				else if (ev.tgt.ioevs[0].iv == 2){
 					size_t bsz = nb * cont->addr->h;
 					ch->switch_clock(ch, RW_CLK_BLOCK);
-					pthread_mutex_lock(&fsense.flock);
 					fsense.ofs += bsz;
 					if (fsense.ofs > fsense.fmap_sz - bsz)
 						fsense.ofs = fsense.fmap_sz - bsz;
-					size_t lofs = fsense.ofs;
+					refresh_data(ch, fsense.ofs, bsz);
+				}
+/* next / previous search hit, the window starts at the hit and stays
+ * put if there is none (but the frame is still sent for the step) */
+				else if (ev.tgt.ioevs[0].iv == 3 || ev.tgt.ioevs[0].iv == -3){
+					ch->switch_clock(ch, RW_CLK_BLOCK);
+					size_t lofs = fsense.hit_set && fsense.hit_win == fsense.ofs ?
+						fsense.hit_ofs : fsense.ofs;
+					pthread_mutex_lock(&fsense.flock);
+					bool found = seek_hit(ev.tgt.ioevs[0].iv, &lofs);
 					pthread_mutex_unlock(&fsense.flock);
-					refresh_data(ch, lofs, bsz);
+					if (found){
+						fsense.ofs = lofs > fsense.fmap_sz - bsz ?
+							fsense.fmap_sz - bsz : lofs;
+						fsense.hit_ofs = lofs;
+						fsense.hit_win = fsense.ofs;
+						fsense.hit_set = true;
+					}
+					refresh_data(ch, fsense.ofs, bsz);
 				}
 			}
 			default:
@@ -234,56 +530,365 @@ void* data_loop(void* th_data)
 	}
 }
 
-static void update_preview(struct arcan_shmif_cont* c, uint8_t* buf, size_t s)
+/*
+ * The preview is a reduction of the whole file where each pixel covers
+ * step_sz bytes and shows the entropy (r), mean (g) and max (b) of them.
+ * Workers take chunks of pixels in file order and the preview thread
+ * synchs whenever some have completed, so the preview fills in while
+ * the file is being read rather than blocking startup.
+ */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct arcan_shmif_cont* c;
+	size_t step_sz, np;
+	size_t next, done, n_chunks;
+} preview = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER
+};
+
+/* pixels per work item, and upper bound for the number of workers */
+static const size_t preview_chunk = 1024;
+#define PREVIEW_WORKERS 8
+
+static inline shmif_pixel preview_px(uint8_t ent, uint8_t mean, uint8_t max)
 {
-	size_t np = c->addr->w * c->addr->h;
-	size_t step_sz = s / np;
+	return RGBA(ent, mean, max, 0xff);
+}
 
-	shmif_pixel* px = c->vidp;
-	uint8_t* wb = buf;
-	while (wb - buf < s){
-		uint8_t val = *wb;
-		*px++ = RGBA(0, val, 0, 0xff);
-		wb += step_sz;
+static shmif_pixel reduce_bucket(const uint8_t* buf, size_t n)
+{
+	uint32_t hgram[256] = {0};
+	for (size_t i = 0; i < n; i++)
+		hgram[ buf[i] ]++;
+
+	uint64_t sum = 0;
+	uint8_t max = 0;
+	float ent = 0.0f;
+
+	for (size_t i = 0; i < 256; i++)
+		if (hgram[i]){
+			float p = (float) hgram[i] / (float) n;
+			ent -= p * log2f(p);
+			sum += (uint64_t) hgram[i] * i;
+			max = i;
+		}
+
+	return preview_px((uint8_t) (255.0f * (ent / 8.0f)), sum / n, max);
+}
+
+/* number of bytes that differ between a and b */
+static size_t diff_count(const uint8_t* a, const uint8_t* b, size_t n)
+{
+	size_t i = 0, neq = 0;
+#if defined(__SSE2__)
+	for (; i + 16 <= n; i += 16){
+		__m128i va = _mm_loadu_si128((const __m128i*) &a[i]);
+		__m128i vb = _mm_loadu_si128((const __m128i*) &b[i]);
+		neq += 16 - __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)));
 	}
+#endif
+	for (; i < n; i++)
+		neq += a[i] != b[i];
 
-	fsense.bytes_perline = step_sz * c->addr->w;
-	arcan_shmif_signal(c, SHMIF_SIGVID);
+	return neq;
 }
 
-int main(int argc, char* argv[])
+/*
+ * diff mode preview, the share of bytes that differ (r, rounded up so
+ * that any difference shows) and b raised for any difference at all
+ */
+static shmif_pixel reduce_diff(const uint8_t* a, const uint8_t* b, size_t n)
 {
-	struct senseye_cont cont;
-	struct arg_arr* aarr;
-	size_t base = 256;
+	size_t neq = diff_count(a, b, n);
+	uint8_t frac = (neq * 255 + n - 1) / n;
+	return preview_px(frac, 0, neq ? 0xff : 0);
+}
 
-	if (2 != argc){
-		printf("usage: fsense filename\n");
-		return EXIT_FAILURE;
+static void* preview_worker(void* tag)
+{
+	shmif_pixel* px = preview.c->vidp;
+	size_t step_sz = preview.step_sz;
+
+	pthread_mutex_lock(&preview.lock);
+	while (preview.next < preview.n_chunks){
+		size_t p1 = preview.next++ * preview_chunk;
+		pthread_mutex_unlock(&preview.lock);
+
+		size_t p2 = p1 + preview_chunk > preview.np ? preview.np : p1 + preview_chunk;
+		size_t ofs = p1 * step_sz;
+
+/* reset after, the data channel access pattern is anything but */
+		advise_window(ofs, (p2 - p1) * step_sz, MADV_SEQUENTIAL);
+		for (size_t i = p1; i < p2; i++, ofs += step_sz)
+			px[i] = fsense.dmap ?
+				reduce_diff(fsense.fmap + ofs, fsense.dmap + ofs, step_sz) :
+				reduce_bucket(fsense.fmap + ofs, step_sz);
+		advise_window(p1 * step_sz, (p2 - p1) * step_sz, MADV_NORMAL);
+
+		pthread_mutex_lock(&preview.lock);
+		preview.done++;
+		pthread_cond_broadcast(&preview.cond);
+	}
+
+	pthread_mutex_unlock(&preview.lock);
+	return NULL;
+}
+
+static void search_hit(size_t ofs, uint32_t id, void* tag)
+{
+	struct hit_list* l = tag;
+	if (l->n == l->cap){
+		size_t ncap = l->cap ? l->cap * 2 : 64;
+		size_t* buf = ncap <= search_chunk_hits ?
+			realloc(l->ofs, sizeof(size_t) * ncap) : NULL;
+		if (!buf){
+			l->full = true;
+			return;
+		}
+		l->ofs = buf;
+		l->cap = ncap;
 	}
 
-	int fd = open(argv[1], O_RDONLY);
+/* several patterns can match at the same offset */
+	ofs += l->base;
+	if (!l->n || l->ofs[l->n - 1] != ofs)
+		l->ofs[l->n++] = ofs;
+}
+
+static void* search_worker(void* tag)
+{
+	pthread_mutex_lock(&search.lock);
+	while (search.next < search.n_chunks){
+		struct hit_list* l = &search.chunks[search.next++];
+		pthread_mutex_unlock(&search.lock);
+
+		size_t n = fsense.fmap_sz - l->base;
+		n = n > SEARCH_CHUNK ? SEARCH_CHUNK : n;
+
+		advise_range(fsense.fmap + l->base, n, MADV_SEQUENTIAL);
+		rwstat_search(search.set, fsense.fmap + l->base, n,
+			fsense.fmap_sz - l->base, search_hit, l);
+		advise_range(fsense.fmap + l->base, n, MADV_NORMAL);
+
+		pthread_mutex_lock(&search.lock);
+	}
+
+	pthread_mutex_unlock(&search.lock);
+	return NULL;
+}
+
+static void search_run()
+{
+	search.n_chunks = (fsense.fmap_sz + SEARCH_CHUNK - 1) / SEARCH_CHUNK;
+	search.chunks = malloc(sizeof(struct hit_list) * search.n_chunks);
+	if (!search.chunks)
+		return;
+
+	for (size_t i = 0; i < search.n_chunks; i++)
+		search.chunks[i] = (struct hit_list){.base = i * SEARCH_CHUNK};
+
+	long nw = sysconf(_SC_NPROCESSORS_ONLN);
+	nw = nw < 1 ? 1 : (nw > PREVIEW_WORKERS ? PREVIEW_WORKERS : nw);
+	pthread_t workers[PREVIEW_WORKERS];
+
+	long nst = 0;
+	for (; nst < nw; nst++)
+		if (0 != pthread_create(&workers[nst], NULL, search_worker, NULL))
+			break;
+
+	if (0 == nst)
+		search_worker(NULL);
+
+	for (long i = 0; i < nst; i++)
+		pthread_join(workers[i], NULL);
+
+	size_t total = 0, n_full = 0;
+	for (size_t i = 0; i < search.n_chunks; i++){
+		total += search.chunks[i].n;
+		n_full += search.chunks[i].full;
+	}
+
+	size_t* hits = malloc(sizeof(size_t) * (total + 1));
+	size_t n = 0;
+	for (size_t i = 0; i < search.n_chunks; i++){
+		struct hit_list* l = &search.chunks[i];
+		if (hits)
+			memcpy(&hits[n], l->ofs, sizeof(size_t) * l->n);
+		n += l->n;
+		free(l->ofs);
+	}
+	free(search.chunks);
+	search.chunks = NULL;
+
+	if (!hits)
+		return;
+
+	if (n_full)
+		fprintf(stderr, "fsense:search_run(), %zu hits, %zu chunks had more "
+			"than %zu hits and were truncated\n", n, n_full, search_chunk_hits);
+
+	pthread_mutex_lock(&fsense.flock);
+	search.hits = hits;
+	search.n_hits = n;
+	pthread_mutex_unlock(&fsense.flock);
+
+/* mark the preview pixels that cover at least one hit */
+	shmif_pixel* px = preview.c->vidp;
+	for (size_t i = 0; i < n; i++){
+		size_t pi = hits[i] / preview.step_sz;
+		if (pi < preview.np)
+			px[pi] = RGBA(0xff, 0xff, 0xff, 0xff);
+	}
+
+	arcan_shmif_signal(preview.c, SHMIF_SIGVID);
+}
+
+static void* search_thread(void* tag)
+{
+	search_run();
+	return NULL;
+}
+
+static void* preview_thread(void* tag)
+{
+	long nw = sysconf(_SC_NPROCESSORS_ONLN);
+	nw = nw < 1 ? 1 : (nw > PREVIEW_WORKERS ? PREVIEW_WORKERS : nw);
+	pthread_t workers[PREVIEW_WORKERS];
+
+	long nst = 0;
+	for (; nst < nw; nst++)
+		if (0 != pthread_create(&workers[nst], NULL, preview_worker, NULL))
+			break;
+
+	if (0 == nst)
+		preview_worker(NULL);
+
+/* the synch blocks until the parent has consumed the frame, and more
+ * chunks may have completed by then */
+	size_t seen = 0;
+	pthread_mutex_lock(&preview.lock);
+	while (seen < preview.n_chunks){
+		while (preview.done == seen)
+			pthread_cond_wait(&preview.cond, &preview.lock);
+		seen = preview.done;
+		pthread_mutex_unlock(&preview.lock);
+		arcan_shmif_signal(preview.c, SHMIF_SIGVID);
+		pthread_mutex_lock(&preview.lock);
+	}
+	pthread_mutex_unlock(&preview.lock);
+
+	for (long i = 0; i < nst; i++)
+		pthread_join(workers[i], NULL);
+
+	if (search.set)
+		search_run();
+
+/* with the file likely in the page cache, build the index for the
+ * next time around */
+	fsidx_build(fsense.idx, NULL, NULL);
+	return NULL;
+}
+
+static void update_preview(struct arcan_shmif_cont* c)
+{
+	size_t np = c->addr->w * c->addr->h;
+	size_t step_sz = fsense.fmap_sz / np;
+	shmif_pixel* px = c->vidp;
+	fsense.bytes_perline = step_sz * c->addr->w;
+
+	if (step_sz >= fsidx_blocksz(fsense.idx) && fsidx_ready(fsense.idx)){
+		for (size_t i = 0; i < np; i++){
+			struct fsidx_ent ent = {0};
+			fsidx_stats(fsense.idx, i * step_sz, step_sz, &ent);
+			px[i] = preview_px(ent.ent, ent.mean, ent.max);
+		}
+
+		arcan_shmif_signal(c, SHMIF_SIGVID);
+
+		preview.c = c;
+		preview.np = np;
+		preview.step_sz = step_sz;
+		pthread_t pth;
+		if (search.set && 0 == pthread_create(&pth, NULL, search_thread, NULL))
+			pthread_detach(pth);
+		return;
+	}
+
+	for (size_t i = 0; i < np; i++)
+		px[i] = RGBA(0x00, 0x00, 0x00, 0xff);
+
+	preview.c = c;
+	preview.np = np;
+	preview.step_sz = step_sz;
+	preview.n_chunks = (np + preview_chunk - 1) / preview_chunk;
+
+	pthread_t pth;
+	if (0 != pthread_create(&pth, NULL, preview_thread, NULL))
+		preview_thread(NULL);
+	else
+		pthread_detach(pth);
+}
+
+static uint8_t* map_file(const char* path, size_t base, int* fd, size_t* sz)
+{
+	*fd = open(path, O_RDONLY);
 	struct stat buf;
-	if (-1 == fstat(fd, &buf)){
-		fprintf(stderr, "couldn't stat file, check permissions and file state.\n");
-		return EXIT_FAILURE;
+	if (-1 == fstat(*fd, &buf)){
+		fprintf(stderr, "couldn't stat %s, check permissions and file state.\n",
+			path);
+		return NULL;
 	}
 
 	if (!S_ISREG(buf.st_mode)){
-		fprintf(stderr, "invalid file mode, expecting a regular file.\n");
-		return EXIT_FAILURE;
+		fprintf(stderr, "invalid file mode (%s), expecting a regular file.\n",
+			path);
+		return NULL;
 	}
 
 	if (buf.st_size < base * base && buf.st_size < 128 * 512){
-		fprintf(stderr, "file too small, expecting "
-			"*at least* %zu and %zu bytes.\n", base*base, (size_t) (128 * 512));
+		fprintf(stderr, "file (%s) too small, expecting *at least* %zu and "
+			"%zu bytes.\n", path, base*base, (size_t) (128 * 512));
+		return NULL;
+	}
+
+	uint8_t* map = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, *fd, 0);
+	if (MAP_FAILED == map){
+		fprintf(stderr, "couldn't mmap %s.\n", path);
+		return NULL;
+	}
+
+	*sz = buf.st_size;
+	return map;
+}
+
+int main(int argc, char* argv[])
+{
+	struct senseye_cont cont;
+	struct arg_arr* aarr;
+	size_t base = 256;
+
+	if (2 != argc && 3 != argc){
+		printf("usage: fsense filename [diff-filename]\n");
 		return EXIT_FAILURE;
 	}
 
-	fsense.fmap = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-	if (MAP_FAILED == fsense.fmap){
-		fprintf(stderr, "couldn't mmap file.\n");
+	int fd;
+	size_t fsz;
+	fsense.fmap = map_file(argv[1], base, &fd, &fsz);
+	if (!fsense.fmap)
 		return EXIT_FAILURE;
+
+/* diff mode, everything past the end of the shorter file is ignored */
+	if (3 == argc){
+		int dfd;
+		size_t dsz;
+		fsense.dmap = map_file(argv[2], base, &dfd, &dsz);
+		if (!fsense.dmap)
+			return EXIT_FAILURE;
+		close(dfd);
+		fsz = dsz < fsz ? dsz : fsz;
 	}
 
 	if (!senseye_connect(NULL, stderr, &cont, &aarr))
@@ -298,6 +903,14 @@ int main(int argc, char* argv[])
 		return EXIT_FAILURE;
 	}
 
+/* patterns are only added when the channel is opened, so the snapshot
+ * for the whole-file search can be taken before the data thread runs */
+	search.set = rwstat_search_new(ch->in);
+	if (!rwstat_search_maxlen(search.set)){
+		rwstat_search_free(search.set);
+		search.set = NULL;
+	}
+
 /* use a pipe to signal / wake to split polling events on
  * shared memory interface with communication between main and secondary
  * segments */
@@ -309,13 +922,25 @@ int main(int argc, char* argv[])
 	fcntl(sigpipe[1], F_SETFL, O_NONBLOCK);
 
 	pthread_mutex_init(&fsense.flock, NULL);
-	fsense.fmap_sz = buf.st_size;
+	fsense.fmap_sz = fsz;
+	fsense.cont = &cont;
+	cont.dispatch = control_event;
+
+/* with a matching sidecar the preview is drawn from the index, otherwise
+ * the index is built after the preview has been reduced from the file,
+ * it only describes the first file so it is of no use in diff mode */
+	const char* val;
+	if (!fsense.dmap && (!aarr || !arg_lookup(aarr, "noindex", 0, &val)))
+		fsense.idx = fsidx_open(argv[1], fd);
+
+	fsense.cache_sz = 32 * 1024 * 1024;
+	if (aarr && arg_lookup(aarr, "cache", 0, &val))
+		fsense.cache_sz = strtoul(val, NULL, 10) * 1024 * 1024;
+
 	pthread_t pth;
 	pthread_create(&pth, NULL, data_loop, ch);
 
-	update_preview(cont.context(&cont), fsense.fmap, buf.st_size);
-	fsense.cont = &cont;
-	cont.dispatch = control_event;
+	update_preview(cont.context(&cont));
 
 	while (senseye_pump(&cont)){
 	}
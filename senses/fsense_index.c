@@ -0,0 +1,462 @@
+/*
+ * Copyright 2015, Björn Ståhl
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Builds, stores and queries the fsense block statistics
+ * pyramid, see fsense_index.h for the interface.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "fsense_index.h"
+
+#define SIDX_MAGIC "SENSIDX1"
+#define SIDX_MAX_LEVELS 32
+
+/* bytes per entry in level 0, and the growth factor between levels */
+static const size_t block_sz = 16384;
+static const size_t fanout = 4;
+
+/* unit of the reads when building */
+static const size_t chunk_sz = 1024 * 1024;
+
+/*
+ * sidecar layout is this header followed by the entries of each level,
+ * finest first, the number of entries in each level is derived from
+ * file_sz, block_sz and fanout
+ */
+struct sidx_hdr {
+	char magic[8];
+	uint64_t file_sz;
+	int64_t mtime;
+	uint32_t block_sz;
+	uint32_t fanout;
+	uint32_t n_levels;
+	uint32_t ent_sz;
+};
+
+/* histogram for the entry that is currently being built in a level */
+struct sidx_acc {
+	uint64_t hgram[256];
+	size_t nb;
+	size_t pos;
+};
+
+struct fsidx {
+	char* path;
+	int fd;
+	size_t file_sz;
+	int64_t mtime;
+
+	size_t n_levels;
+	size_t level_ofs[SIDX_MAX_LEVELS];
+	size_t level_n[SIDX_MAX_LEVELS];
+	size_t n_ents;
+
+/* either allocated (built) or pointing into map (loaded) */
+	struct fsidx_ent* ents;
+	void* map;
+	size_t map_sz;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	bool ready, building, alive;
+
+	void (*done)(struct fsidx*, void*);
+	void* tag;
+};
+
+static void setup_levels(struct fsidx* idx)
+{
+	size_t n = (idx->file_sz + block_sz - 1) / block_sz;
+	idx->n_levels = 0;
+	idx->n_ents = 0;
+
+	while (idx->n_levels < SIDX_MAX_LEVELS){
+		idx->level_ofs[idx->n_levels] = idx->n_ents;
+		idx->level_n[idx->n_levels++] = n;
+		idx->n_ents += n;
+		if (n <= 1)
+			break;
+		n = (n + fanout - 1) / fanout;
+	}
+}
+
+static void ent_final(struct fsidx_ent* ent, const uint64_t* hgram)
+{
+	uint64_t n = 0, sum = 0;
+	uint64_t nib[16] = {0};
+	int min = -1, max = 0;
+
+	for (size_t i = 0; i < 256; i++){
+		if (!hgram[i])
+			continue;
+		if (min == -1)
+			min = i;
+		max = i;
+		n += hgram[i];
+		sum += hgram[i] * i;
+		nib[i >> 4] += hgram[i];
+	}
+
+	memset(ent, '\0', sizeof(struct fsidx_ent));
+	if (0 == n)
+		return;
+
+	float acc = 0.0f;
+	for (size_t i = 0; i < 256; i++)
+		if (hgram[i]){
+			float p = (float) hgram[i] / (float) n;
+			acc -= p * log2f(p);
+		}
+
+	ent->min = min;
+	ent->max = max;
+	ent->mean = sum / n;
+	ent->ent = (uint8_t) (255.0f * (acc / 8.0f));
+	for (size_t i = 0; i < 16; i++)
+		ent->hgram[i] = (uint8_t) (255 * nib[i] / n);
+}
+
+/*
+ * finish the current entry of level k and feed it to the level above,
+ * on the last block every level is flushed
+ */
+static void acc_push(struct fsidx* idx, struct sidx_acc* acc, size_t k, bool last)
+{
+	struct sidx_acc* a = &acc[k];
+	if (a->pos < idx->level_n[k])
+		ent_final(&idx->ents[idx->level_ofs[k] + a->pos++], a->hgram);
+
+	if (k + 1 < idx->n_levels){
+		struct sidx_acc* up = &acc[k + 1];
+		for (size_t i = 0; i < 256; i++)
+			up->hgram[i] += a->hgram[i];
+
+		if (++up->nb == fanout || last)
+			acc_push(idx, acc, k + 1, last);
+	}
+
+	memset(a->hgram, '\0', sizeof(a->hgram));
+	a->nb = 0;
+}
+
+/*
+ * write to a temporary file next to the destination and rename so that
+ * a reader never sees a partial sidecar, failure is not fatal as the
+ * index is still usable from memory
+ */
+static void sidecar_store(struct fsidx* idx)
+{
+	size_t plen = strlen(idx->path) + sizeof(".sidx.XXXXXX");
+	char* tmp = malloc(plen);
+	char* dst = malloc(plen);
+	if (!tmp || !dst)
+		goto out;
+
+	snprintf(dst, plen, "%s.sidx", idx->path);
+	snprintf(tmp, plen, "%s.sidx.XXXXXX", idx->path);
+	int fd = mkstemp(tmp);
+	if (-1 == fd)
+		goto out;
+
+	struct sidx_hdr hdr = {
+		.file_sz = idx->file_sz,
+		.mtime = idx->mtime,
+		.block_sz = block_sz,
+		.fanout = fanout,
+		.n_levels = idx->n_levels,
+		.ent_sz = sizeof(struct fsidx_ent)
+	};
+	memcpy(hdr.magic, SIDX_MAGIC, sizeof(hdr.magic));
+
+	bool ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr);
+	uint8_t* src = (uint8_t*) idx->ents;
+	size_t left = idx->n_ents * sizeof(struct fsidx_ent);
+
+	while (ok && left){
+		ssize_t nw = write(fd, src, left);
+		if (-1 == nw && errno == EINTR)
+			continue;
+		if (nw <= 0)
+			ok = false;
+		else {
+			src += nw;
+			left -= nw;
+		}
+	}
+
+	close(fd);
+	if (!ok || -1 == rename(tmp, dst))
+		unlink(tmp);
+
+out:
+	free(tmp);
+	free(dst);
+}
+
+static bool sidecar_load(struct fsidx* idx)
+{
+	size_t plen = strlen(idx->path) + sizeof(".sidx");
+	char* path = malloc(plen);
+	if (!path)
+		return false;
+
+	snprintf(path, plen, "%s.sidx", idx->path);
+	int fd = open(path, O_RDONLY);
+	free(path);
+	if (-1 == fd)
+		return false;
+
+	struct stat fs;
+	size_t exp_sz = sizeof(struct sidx_hdr) + idx->n_ents * sizeof(struct fsidx_ent);
+	if (-1 == fstat(fd, &fs) || fs.st_size != exp_sz){
+		close(fd);
+		return false;
+	}
+
+	void* map = mmap(NULL, exp_sz, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (MAP_FAILED == map)
+		return false;
+
+	struct sidx_hdr* hdr = map;
+	if (memcmp(hdr->magic, SIDX_MAGIC, sizeof(hdr->magic)) != 0 ||
+		hdr->file_sz != idx->file_sz || hdr->mtime != idx->mtime ||
+		hdr->block_sz != block_sz || hdr->fanout != fanout ||
+		hdr->n_levels != idx->n_levels ||
+		hdr->ent_sz != sizeof(struct fsidx_ent)){
+		munmap(map, exp_sz);
+		return false;
+	}
+
+	idx->map = map;
+	idx->map_sz = exp_sz;
+	idx->ents = (struct fsidx_ent*) ((uint8_t*) map + sizeof(struct sidx_hdr));
+	return true;
+}
+
+static bool build_alive(struct fsidx* idx)
+{
+	pthread_mutex_lock(&idx->lock);
+	bool alive = idx->alive;
+	pthread_mutex_unlock(&idx->lock);
+	return alive;
+}
+
+/*
+ * single sequential pass through its own descriptor, independent of the
+ * mapping used for the data channel so it doesn't fault that in
+ */
+static void* build_thread(void* tag)
+{
+	struct fsidx* idx = tag;
+	uint8_t* buf = malloc(chunk_sz);
+	struct sidx_acc* acc = calloc(idx->n_levels, sizeof(struct sidx_acc));
+	bool ok = buf && acc;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(idx->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	size_t ofs = 0;
+	while (ok && ofs < idx->file_sz && build_alive(idx)){
+		size_t ntr = idx->file_sz - ofs > chunk_sz ? chunk_sz : idx->file_sz - ofs;
+		ssize_t nr = pread(idx->fd, buf, ntr, ofs);
+		if (-1 == nr && errno == EINTR)
+			continue;
+		if (nr <= 0){
+			ok = false;
+			break;
+		}
+
+		for (size_t i = 0; i < nr;){
+			size_t n = block_sz - ofs % block_sz;
+			n = n > nr - i ? nr - i : n;
+
+			for (size_t j = 0; j < n; j++)
+				acc[0].hgram[ buf[i + j] ]++;
+
+			i += n;
+			ofs += n;
+			if (ofs % block_sz == 0 || ofs == idx->file_sz)
+				acc_push(idx, acc, 0, ofs == idx->file_sz);
+		}
+	}
+
+	free(buf);
+	free(acc);
+	ok = ok && ofs == idx->file_sz;
+
+	if (ok)
+		sidecar_store(idx);
+
+	pthread_mutex_lock(&idx->lock);
+	idx->ready = ok;
+	pthread_mutex_unlock(&idx->lock);
+
+	if (ok && idx->done)
+		idx->done(idx, idx->tag);
+
+	return NULL;
+}
+
+struct fsidx* fsidx_open(const char* path, int fd)
+{
+	struct stat fs;
+	if (!path || -1 == fstat(fd, &fs) || fs.st_size < block_sz)
+		return NULL;
+
+	struct fsidx* idx = malloc(sizeof(struct fsidx));
+	if (!idx)
+		return NULL;
+
+	memset(idx, '\0', sizeof(struct fsidx));
+	idx->path = strdup(path);
+	idx->file_sz = fs.st_size;
+	idx->mtime = fs.st_mtime;
+	idx->fd = -1;
+	pthread_mutex_init(&idx->lock, NULL);
+	setup_levels(idx);
+
+	if (!idx->path){
+		fsidx_close(idx);
+		return NULL;
+	}
+
+	if (sidecar_load(idx))
+		idx->ready = true;
+
+	return idx;
+}
+
+bool fsidx_build(struct fsidx* idx,
+	void (*done)(struct fsidx*, void* tag), void* tag)
+{
+	if (!idx || idx->building || idx->ready)
+		return idx != NULL;
+
+/* own descriptor so the read offset / advice doesn't interfere */
+	idx->fd = open(idx->path, O_RDONLY);
+	idx->ents = malloc(idx->n_ents * sizeof(struct fsidx_ent));
+	if (-1 == idx->fd || !idx->ents)
+		goto fail;
+
+	idx->done = done;
+	idx->tag = tag;
+	idx->alive = true;
+	if (0 != pthread_create(&idx->thread, NULL, build_thread, idx))
+		goto fail;
+
+	idx->building = true;
+	return true;
+
+fail:
+	if (-1 != idx->fd)
+		close(idx->fd);
+	idx->fd = -1;
+	free(idx->ents);
+	idx->ents = NULL;
+	idx->alive = false;
+	return false;
+}
+
+bool fsidx_ready(struct fsidx* idx)
+{
+	if (!idx)
+		return false;
+
+	pthread_mutex_lock(&idx->lock);
+	bool ready = idx->ready;
+	pthread_mutex_unlock(&idx->lock);
+	return ready;
+}
+
+size_t fsidx_blocksz(struct fsidx* idx)
+{
+	return block_sz;
+}
+
+bool fsidx_stats(struct fsidx* idx, size_t ofs, size_t len, struct fsidx_ent* out)
+{
+	if (!fsidx_ready(idx) || ofs >= idx->file_sz || 0 == len)
+		return false;
+
+	if (len > idx->file_sz - ofs)
+		len = idx->file_sz - ofs;
+
+/* coarsest level that still resolves len */
+	size_t k = 0, bsz = block_sz;
+	while (k + 1 < idx->n_levels && bsz * fanout <= len){
+		bsz *= fanout;
+		k++;
+	}
+
+	size_t first = ofs / bsz;
+	size_t last = (ofs + len - 1) / bsz;
+	if (last >= idx->level_n[k])
+		last = idx->level_n[k] - 1;
+
+	const struct fsidx_ent* ents = &idx->ents[idx->level_ofs[k]];
+	size_t n = last - first + 1;
+	uint32_t mean = 0, ent = 0;
+	uint32_t hgram[16] = {0};
+	out->min = 0xff;
+	out->max = 0;
+
+	for (size_t i = first; i <= last; i++){
+		if (ents[i].min < out->min)
+			out->min = ents[i].min;
+		if (ents[i].max > out->max)
+			out->max = ents[i].max;
+		mean += ents[i].mean;
+		ent += ents[i].ent;
+		for (size_t j = 0; j < 16; j++)
+			hgram[j] += ents[i].hgram[j];
+	}
+
+	out->mean = mean / n;
+	out->ent = ent / n;
+	for (size_t j = 0; j < 16; j++)
+		out->hgram[j] = hgram[j] / n;
+
+	return true;
+}
+
+void fsidx_close(struct fsidx* idx)
+{
+	if (!idx)
+		return;
+
+	if (idx->building){
+		pthread_mutex_lock(&idx->lock);
+		idx->alive = false;
+		pthread_mutex_unlock(&idx->lock);
+		pthread_join(idx->thread, NULL);
+	}
+
+	if (idx->map)
+		munmap(idx->map, idx->map_sz);
+	else
+		free(idx->ents);
+
+	if (-1 != idx->fd)
+		close(idx->fd);
+
+	pthread_mutex_destroy(&idx->lock);
+	free(idx->path);
+	free(idx);
+}
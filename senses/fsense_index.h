@@ -0,0 +1,48 @@
+/*
+ * Copyright 2015, Björn Ståhl
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Per-block statistics index for fsense. The file is reduced
+ * once into a pyramid of block statistics (each level covering fanout
+ * times more bytes per entry than the one below) that is stored in a
+ * sidecar file (<file>.sidx) so that repeated analysis of the same file
+ * can skip the pass completely.
+ */
+
+struct fsidx_ent {
+	uint8_t min, max, mean;
+	uint8_t ent; /* shannon entropy, 0..8 bits scaled to 0..255 */
+	uint8_t hgram[16]; /* normalized count per high nibble */
+};
+
+struct fsidx;
+
+/*
+ * Prepare the index for path and load the sidecar if it matches the
+ * file (size, mtime), then the index is ready immediately.
+ */
+struct fsidx* fsidx_open(const char* path, int fd);
+
+/*
+ * Start building the index in the background (unless it is already
+ * ready or building), writing it to the sidecar (if possible) when done.
+ * done is invoked from the building thread when the index becomes ready.
+ */
+bool fsidx_build(struct fsidx*, void (*done)(struct fsidx*, void* tag), void* tag);
+
+/* true when the index can be queried */
+bool fsidx_ready(struct fsidx*);
+
+/* size in bytes covered by each entry in the finest level */
+size_t fsidx_blocksz(struct fsidx*);
+
+/*
+ * Aggregate the statistics for the bytes [ofs, ofs+len) from the coarsest
+ * level that still has one entry per len bytes. min, max are exact for
+ * the covered blocks, the rest are averages of the blocks. Returns false
+ * if the index is not ready or the range is outside the file.
+ */
+bool fsidx_stats(struct fsidx*, size_t ofs, size_t len, struct fsidx_ent* out);
+
+/* stop any pending build and release the index */
+void fsidx_close(struct fsidx*);
@@ -35,6 +35,7 @@
 #include <string.h>
 #include <errno.h>
 #include <math.h>
+#include <limits.h>
 
 #include <arcan_shmif.h>
 #include <poll.h>
@@ -50,12 +51,48 @@
 #include "senseye.h"
 #include "font_8x8.h"
 #include "rwstat.h"
+#include "msense_read.h"
 
 struct page_ch {
 	struct senseye_ch* channel;
-	int fd;
 	uintptr_t base;
 	size_t size;
+
+/* address of the current window */
+	uintptr_t cofs;
+
+/* window contents, kept between refreshes for the delta path, buf_cap
+ * only grows so that flipping between window sizes doesn't reallocate */
+	uint8_t* buf;
+	size_t buf_sz;
+	size_t buf_cap;
+
+/* delta tracking for the current window, one entry per touched page,
+ * cand is scratch for the refresh, dirty is guarded by dlock */
+	bool valid;
+	size_t win_sz;
+	size_t n_pages;
+	uint64_t* hashes;
+	uint64_t* pm;
+	uint8_t* dirty;
+	uint8_t* cand;
+
+/* scheduling: stepframes not yet answered, when the next timed refresh
+ * is due and the part of the batched read that belongs to the window */
+	size_t want;
+	unsigned long long next_ts;
+	bool full, queued;
+	size_t req_ofs, n_reqs;
+
+	struct page_ch* next;
+};
+
+enum delta_mode {
+	DELTA_OFF = 0,
+/* hash every page in the window, only unchanged ones avoid the rebuild */
+	DELTA_HASH,
+/* as above, but only re-read pages the kernel marked as soft-dirty */
+	DELTA_SOFTDIRTY
 };
 
 struct {
@@ -64,6 +101,25 @@ struct {
 	pid_t pid;
 	pthread_mutex_t plock;
 
+/* shared by all channels, thread-safe */
+	struct mreader* reader;
+	size_t page_sz;
+
+/* changed-page detection, clear_refs resets the soft-dirty bits for the
+ * entire process so all tracked windows are collected in one go */
+	enum delta_mode delta;
+	pthread_mutex_t dlock;
+	struct page_ch* tracked;
+	int pagemap_fd, clear_refs_fd;
+
+/* all windows are served by one scheduler thread, woken through the pipe
+ * when a window is added. refresh_ms (0, only on request) is the timed
+ * refresh rate and budget (0, unlimited) caps the bytes read per second
+ * across all windows. */
+	int wake[2];
+	unsigned refresh_ms;
+	size_t budget;
+
 /* cursor tracking */
 	ssize_t sel;
 	size_t sel_lim, sel_page;
@@ -74,68 +130,89 @@ struct {
 /* external connections */
 	struct senseye_cont* cont;
 } msense = {
- .skip_inode = true
+ .skip_inode = true,
+ .delta = DELTA_HASH,
+ .pagemap_fd = -1,
+ .clear_refs_fd = -1
 };
 
 static void update_preview(shmif_pixel ccol);
-void* data_loop(void*);
+static bool refresh_regions(bool report);
+static void* sched_loop(void*);
+static void track(struct page_ch* pch, bool on);
+
+struct launch_req {
+	uintptr_t base;
+	size_t size;
+};
 
 /*
- * try to acquire a handle into the memory of the process
- * at a specific base and width, if successful, spawn a new
- * data connection to senseye.
+ * the parent has answered a data channel request from launch_addr, hand
+ * the new channel to the scheduler
  */
-static void launch_addr(uintptr_t base, size_t size)
+static void launch_done(struct senseye_cont* cont, struct senseye_ch* ch, void* tag)
 {
-	char wbuf[sizeof("/proc//mem") + 8];
-	snprintf(wbuf, sizeof(wbuf), "/proc/%d/mem", (int) msense.pid);
-	int fd = open(wbuf, O_RDONLY);
-	if (-1 == fd){
-		fprintf(stderr, "launch_addr(%" PRIxPTR ")+%zx open (%s) failed, %s\n",
-			base, size, wbuf, strerror(errno));
-		return;
-	}
-
-	if (-1 == lseek64(fd, base, SEEK_SET)){
-		fprintf(stderr, "launch_addr(%" PRIxPTR ")+%zx  couldn't seek, %s\n",
-			base, size, strerror(errno));
-		close(fd);
-		return;
-	}
-
-/* or calculate base by sqrt -> prev POT */
-	snprintf(wbuf, sizeof(wbuf), "%d@%" PRIxPTR, (int)msense.pid, base);
-	struct senseye_ch* ch = senseye_open(msense.cont, wbuf, 512);
+	struct launch_req* req = tag;
+	uintptr_t base = req->base;
+	size_t size = req->size;
+	free(req);
 
 	if (NULL == ch){
 		fprintf(stderr, "launch_addr(%" PRIxPTR ")+%zx "
 			"couldn't open data channel\n", base, size);
-		close(fd);
 		return;
 	}
 
-	pthread_t pth;
 	struct page_ch* pch = malloc(sizeof(struct page_ch));
 	if (NULL == pch){
 		fprintf(stderr, "launch_addr(%" PRIxPTR ")+%zx "
 			"couldn't setup processing storage\n", base, size);
-		close(fd);
+		ch->close(ch);
 		return;
 	}
 
-	pch->channel = ch;
-	pch->fd = fd;
-	pch->base = base;
-	pch->size = size;
+	*pch = (struct page_ch){
+		.channel = ch,
+		.base = base,
+		.size = size,
+		.cofs = base
+	};
+
+	track(pch, true);
+	char ign = 1;
+	write(msense.wake[1], &ign, 1);
+}
 
-	if (-1 == pthread_create(&pth, NULL, data_loop, pch)){
+/*
+ * try to acquire a handle into the memory of the process
+ * at a specific base and width, if successful, request a new
+ * data connection to senseye, the request completes (launch_done)
+ * from the control loop so several can be outstanding at once.
+ */
+static void launch_addr(uintptr_t base, size_t size)
+{
+	char wbuf[sizeof("/proc//mem") + 8];
+	if (!msense.reader){
+		fprintf(stderr, "launch_addr(%" PRIxPTR ")+%zx no memory reader\n",
+			base, size);
+		return;
+	}
+
+	struct launch_req* req = malloc(sizeof(struct launch_req));
+	if (!req){
 		fprintf(stderr, "launch_addr(%" PRIxPTR ")+%zx "
-			"couldn't spawn processing thread\n", base, size);
-		ch->close(ch);
-		free(pch);
-		close(fd);
+			"couldn't setup processing storage\n", base, size);
 		return;
 	}
+	*req = (struct launch_req){.base = base, .size = size};
+
+/* or calculate base by sqrt -> prev POT */
+	snprintf(wbuf, sizeof(wbuf), "%d@%" PRIxPTR, (int)msense.pid, base);
+	if (!senseye_open_async(msense.cont, wbuf, 512, launch_done, req)){
+		fprintf(stderr, "launch_addr(%" PRIxPTR ")+%zx "
+			"couldn't open data channel\n", base, size);
+		free(req);
+	}
 }
 
 /*
@@ -169,6 +246,10 @@ static void control_event(struct senseye_cont* cont, arcan_event* ev)
 				msense.sel = 0;
 			refresh = true;
 		}
+		else if (strcmp(ev->label, "REFRESH") == 0){
+			refresh_regions(true);
+			refresh = true;
+		}
 		else if (strcmp(ev->label, "SELECT") == 0){
 			if (!msense.ptrace)
 				fprintf(stderr, "cannot inspect segment, ptrace support disabled.\n");
@@ -181,123 +262,902 @@ static void control_event(struct senseye_cont* cont, arcan_event* ev)
 		update_preview(RGBA(0x00, 0xff, 0x00, 0xff));
 }
 
-static size_t synch_copy(struct rwstat_ch* ch, int fd, uint8_t* buf, size_t nb)
+#define PM_SOFT_DIRTY (1ull << 55)
+#define PM_SWAPPED (1ull << 62)
+#define PM_PRESENT (1ull << 63)
+
+static uint64_t page_hash(const uint8_t* buf, size_t n)
 {
-	ch->switch_clock(ch, RW_CLK_BLOCK);
-	pthread_mutex_lock(&msense.plock);
+	uint64_t h = 0xcbf29ce484222325ull;
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8){
+		uint64_t w;
+		memcpy(&w, &buf[i], 8);
+		h = (h ^ w) * 0x100000001b3ull;
+		h ^= h >> 32;
+	}
 
-	ssize_t nr = read(fd, buf, nb);
-	if (-1 == nr)
-		nr = 0;
+	for (; i < n; i++)
+		h = (h ^ buf[i]) * 0x100000001b3ull;
 
-	if (nr != nb)
-		memset(buf + nr, '\0', nb - nr);
+	return h;
+}
 
-#ifdef PTRACE_PRCTL
-	ptrace(PTRACE_CONT, msense.pid, NULL, NULL);
-#endif
+/* byte range in the window buffer covered by page i */
+static size_t win_page(struct page_ch* pch, size_t i, size_t* len)
+{
+	uintptr_t pbase = pch->cofs - (pch->cofs % msense.page_sz);
+	uintptr_t start = pbase + i * msense.page_sz;
+	uintptr_t end = start + msense.page_sz;
 
-	pthread_mutex_unlock(&msense.plock);
+	if (start < pch->cofs)
+		start = pch->cofs;
+	if (end > pch->cofs + pch->win_sz)
+		end = pch->cofs + pch->win_sz;
+
+	*len = end - start;
+	return start - pch->cofs;
+}
+
+/*
+ * Read the pagemap entries for every tracked window and mark the ones that
+ * were written to (or that aren't resident so we can't tell) then reset the
+ * bits. A write that lands between the pread and the clear_refs is missed
+ * until the page is written to again, or the window gets fully refreshed.
+ * Caller holds dlock.
+ */
+static bool softdirty_collect()
+{
+	for (struct page_ch* p = msense.tracked; p; p = p->next){
+		if (!p->n_pages)
+			continue;
+
+		size_t nb = p->n_pages * sizeof(uint64_t);
+		off_t ofs = (p->cofs / msense.page_sz) * sizeof(uint64_t);
+		if (pread(msense.pagemap_fd, p->pm, nb, ofs) != nb)
+			return false;
+
+		for (size_t i = 0; i < p->n_pages; i++)
+			if ((p->pm[i] & PM_SOFT_DIRTY) || !(p->pm[i] & (PM_PRESENT | PM_SWAPPED)))
+				p->dirty[i] = 1;
+	}
+
+	return write(msense.clear_refs_fd, "4", 1) == 1;
+}
+
+static void softdirty_disable()
+{
+	fprintf(stderr, "soft-dirty tracking failed (%s), using page hashes\n",
+		strerror(errno));
+	__atomic_store_n(&msense.delta, DELTA_HASH, __ATOMIC_RELAXED);
+}
+
+static enum delta_mode delta_mode()
+{
+	return __atomic_load_n(&msense.delta, __ATOMIC_RELAXED);
+}
+
+/* move the window, re-dimension the tracking state and force a full read */
+static bool set_window(struct page_ch* pch, uintptr_t cofs, size_t win_sz)
+{
+	size_t pg = msense.page_sz;
+	uintptr_t pbase = cofs - (cofs % pg);
+	size_t np = (cofs + win_sz - pbase + pg - 1) / pg;
+	bool rv = true;
+
+	pthread_mutex_lock(&msense.dlock);
+	if (np != pch->n_pages){
+		free(pch->hashes);
+		free(pch->pm);
+		free(pch->dirty);
+		free(pch->cand);
+		pch->hashes = malloc(np * sizeof(uint64_t));
+		pch->pm = malloc(np * sizeof(uint64_t));
+		pch->dirty = malloc(np);
+		pch->cand = malloc(np);
+		pch->n_pages = np;
+
+		if (!pch->hashes || !pch->pm || !pch->dirty || !pch->cand){
+			free(pch->hashes); free(pch->pm);
+			free(pch->dirty); free(pch->cand);
+			pch->hashes = pch->pm = NULL;
+			pch->dirty = pch->cand = NULL;
+			pch->n_pages = 0;
+			rv = false;
+		}
+	}
+
+	pch->cofs = cofs;
+	pch->win_sz = win_sz;
+	pch->valid = false;
+	if (pch->dirty)
+		memset(pch->dirty, '\0', pch->n_pages);
+	pthread_mutex_unlock(&msense.dlock);
+
+	return rv;
+}
+
+static void track(struct page_ch* pch, bool on)
+{
+	pthread_mutex_lock(&msense.dlock);
+	if (on){
+		pch->next = msense.tracked;
+		msense.tracked = pch;
+	}
+	else {
+		struct page_ch** cur = &msense.tracked;
+		while (*cur && *cur != pch)
+			cur = &(*cur)->next;
+		if (*cur)
+			*cur = pch->next;
+	}
+	pthread_mutex_unlock(&msense.dlock);
+}
+
+/* take and reset the pages marked since the last collect */
+static bool take_dirty(struct page_ch* pch)
+{
+	pthread_mutex_lock(&msense.dlock);
+	bool ok = softdirty_collect();
+	if (ok){
+		memcpy(pch->cand, pch->dirty, pch->n_pages);
+		memset(pch->dirty, '\0', pch->n_pages);
+	}
+	pthread_mutex_unlock(&msense.dlock);
+
+	if (!ok)
+		softdirty_disable();
+	return ok;
+}
+
+/*
+ * Fill reqs (room for n_pages + 1) with what needs to be read to refresh
+ * the window: everything on the first read or when delta tracking is off,
+ * otherwise only the candidate pages with adjacent ones merged.
+ */
+static size_t refresh_prepare(struct page_ch* pch, struct mread_req* reqs)
+{
+	enum delta_mode mode = delta_mode();
+	pch->full = !pch->valid || mode == DELTA_OFF || !pch->n_pages;
+
+	if (pch->full){
+/* bits set before this read are already covered by it */
+		if (mode == DELTA_SOFTDIRTY && pch->n_pages)
+			take_dirty(pch);
+
+		reqs[0] = (struct mread_req){
+			.addr = pch->cofs,
+			.len = pch->win_sz,
+			.buf = pch->buf
+		};
+		return 1;
+	}
+
+	if (!(mode == DELTA_SOFTDIRTY && take_dirty(pch)))
+		memset(pch->cand, 1, pch->n_pages);
+
+	size_t nr = 0;
+	for (size_t i = 0; i < pch->n_pages; i++){
+		if (!pch->cand[i])
+			continue;
+
+		size_t len;
+		size_t ofs = win_page(pch, i, &len);
+		if (nr && reqs[nr-1].buf + reqs[nr-1].len == pch->buf + ofs)
+			reqs[nr-1].len += len;
+		else
+			reqs[nr++] = (struct mread_req){
+				.addr = pch->cofs + ofs,
+				.len = len,
+				.buf = pch->buf + ofs
+			};
+	}
 
-	int ign;
-	ch->data(ch, buf, nb, &ign);
 	return nr;
 }
 
-void* data_loop(void* th_data)
+/*
+ * Compare the pages that were read against the stored hashes, first and
+ * last are set to the changed byte range in the window. Returns the number
+ * of pages that changed (all of them for a full read).
+ */
+static size_t refresh_changed(struct page_ch* pch, size_t* first, size_t* last)
+{
+	*first = 0;
+	*last = pch->win_sz;
+
+	if (pch->full){
+		if (delta_mode() == DELTA_OFF || !pch->n_pages)
+			return 1;
+
+		for (size_t i = 0; i < pch->n_pages; i++){
+			size_t len;
+			size_t ofs = win_page(pch, i, &len);
+			pch->hashes[i] = page_hash(pch->buf + ofs, len);
+		}
+		pch->valid = true;
+		return pch->n_pages;
+	}
+
+	size_t changed = 0;
+	for (size_t i = 0; i < pch->n_pages; i++){
+		if (!pch->cand[i])
+			continue;
+
+		size_t len;
+		size_t ofs = win_page(pch, i, &len);
+		uint64_t h = page_hash(pch->buf + ofs, len);
+		if (h == pch->hashes[i])
+			continue;
+
+		pch->hashes[i] = h;
+		if (!changed++)
+			*first = ofs;
+		*last = ofs + len;
+	}
+
+	return changed;
+}
+
+/* no new frame will be signalled, but the UI still waits for the status */
+static void ack_frame(struct rwstat_ch* ch)
+{
+	arcan_event ev = {
+		.category = EVENT_EXTERNAL,
+		.ext.kind = EVENT_EXTERNAL_FRAMESTATUS
+	};
+	ch->event(ch, &ev);
+}
+
+static void dirty_hint(struct rwstat_ch* ch, size_t first, size_t last)
+{
+	size_t row = ch->row_size(ch);
+	arcan_event ev = {
+		.category = EVENT_EXTERNAL,
+		.ext.kind = EVENT_EXTERNAL_MESSAGE
+	};
+
+	snprintf((char*)ev.ext.message, sizeof(ev.ext.message) / sizeof(ev.ext.message[0]),
+		"dirty:%zu:%zu", first / row, (last - first + row - 1) / row);
+	ch->event(ch, &ev);
+}
+
+/*
+ * Push the refreshed window through rwstat (or only acknowledge it if
+ * nothing changed). Every stepframe needs exactly one framestatus back, the
+ * frame itself provides one and requests that were coalesced into this
+ * refresh are acknowledged separately. Timed refreshes are unsolicited.
+ */
+static void refresh_finish(struct page_ch* pch,
+	struct rwstat_ch* ch, struct mread_req* reqs)
+{
+	size_t nr = 0;
+	for (size_t i = 0; i < pch->n_reqs; i++)
+		nr += reqs[i].nr;
+
+	if (0 == nr && pch->n_reqs)
+		fprintf(stderr, "Couldn't read from ofset (%" PRIxPTR ")\n", pch->cofs);
+
+	size_t first, last;
+	size_t acks = pch->want;
+
+	if (refresh_changed(pch, &first, &last)){
+		int ign;
+		ch->switch_clock(ch, RW_CLK_BLOCK);
+		if (!pch->full && (first > 0 || last < pch->win_sz)){
+			dirty_hint(ch, first, last);
+			ch->damage(ch, first, last - first);
+		}
+
+		ch->borrow(ch, pch->buf, pch->win_sz, &ign);
+		acks = acks ? acks - 1 : 0;
+	}
+
+	while (acks--)
+		ack_frame(ch);
+
+	pch->want = 0;
+}
+
+static bool sched_init(struct page_ch* pch)
 {
-/* we ignore the senseye- abstraction here and works
- * directly with the rwstat and shmif context */
-	struct page_ch* pch = (struct page_ch*)th_data;
 	struct rwstat_ch* ch = pch->channel->in;
-	struct arcan_shmif_cont* cont = ch->context(ch);
 
-	size_t buf_sz = ch->left(ch);
-	uint8_t* buf = malloc(buf_sz);
+	pch->buf_sz = pch->buf_cap = ch->left(ch);
+	pch->buf = malloc(pch->buf_cap);
+	if (!pch->buf || !set_window(pch, pch->cofs, pch->buf_sz))
+		return false;
 
 	arcan_event ev = {
 		.category = EVENT_EXTERNAL,
 		.ext.kind = EVENT_EXTERNAL_IDENT,
 		.ext.message = "msense"
 	};
-
 	ch->event(ch, &ev);
 
-	off64_t cofs = lseek64(pch->fd, 0, SEEK_CUR);
-	goto seek0;
+/* first frame is sent without being asked for */
+	pch->want = 1;
+	return true;
+}
 
-	while (buf && arcan_shmif_wait(cont, &ev) != 0){
+static void sched_close(struct page_ch* pch)
+{
+	track(pch, false);
+	pch->channel->close(pch->channel);
+	free(pch->buf);
+	free(pch->hashes);
+	free(pch->pm);
+	free(pch->dirty);
+	free(pch->cand);
+	free(pch);
+}
+
+/*
+ * Flush the event queue of one window, requests are only recorded here and
+ * served (coalesced) on the next refresh pass. Returns false when the
+ * window should be closed.
+ */
+static bool sched_events(struct page_ch* pch)
+{
+/* we ignore the senseye- abstraction here and works
+ * directly with the rwstat and shmif context */
+	struct rwstat_ch* ch = pch->channel->in;
+	struct arcan_shmif_cont* cont = ch->context(ch);
+	arcan_event ev;
+	int rv;
+
+	while ((rv = arcan_shmif_poll(cont, &ev)) > 0){
+/* any change to packing or size invalidates the previous frame */
 		if (rwstat_consume_event(ch, &ev)){
-			if (ch->left(ch) > buf_sz){
-				free(buf);
-				buf_sz = ch->left(ch);
-				buf = malloc(buf_sz);
+			size_t left = ch->left(ch);
+			if (left > pch->buf_cap){
+				size_t cap = pch->buf_cap * 2 > left ? pch->buf_cap * 2 : left;
+				free(pch->buf);
+				pch->buf = malloc(cap);
+				if (!pch->buf)
+					return false;
+				pch->buf_cap = cap;
 			}
+			pch->buf_sz = left;
+			set_window(pch, pch->cofs, pch->buf_sz);
+			continue;
+		}
+
+		if (ev.category != EVENT_TARGET)
+			continue;
+
+		if (ev.tgt.kind == TARGET_COMMAND_EXIT)
+			return false;
+
+		if (ev.tgt.kind != TARGET_COMMAND_STEPFRAME)
+			continue;
+
+		uintptr_t end = pch->base + pch->size;
+		size_t buf_sz = pch->buf_sz;
+
+		if (ev.tgt.ioevs[0].iv == 0)
+			pch->want++;
+/* step a full window, the last one is aligned to the end of the region */
+		else if (ev.tgt.ioevs[0].iv == 1){
+			if (pch->cofs + 2 * buf_sz > end)
+				set_window(pch, pch->size > buf_sz ?
+					end - buf_sz : pch->base, buf_sz);
+			else
+				set_window(pch, pch->cofs + buf_sz, buf_sz);
+			pch->want++;
+		}
+		else if (ev.tgt.ioevs[0].iv == -1){
+			if (pch->cofs - pch->base > buf_sz)
+				set_window(pch, pch->cofs - buf_sz, buf_sz);
+			else
+				set_window(pch, pch->base, buf_sz);
+			pch->want++;
+		}
+	}
+
+	return rv != -1;
+}
+
+static bool sched_due(struct page_ch* pch, unsigned long long now)
+{
+	return pch->want || (msense.refresh_ms && now >= pch->next_ts);
+}
+
+static int sched_timeout(struct page_ch** chs, size_t n,
+	double tokens, unsigned long long now)
+{
+	long long timeout = -1;
+
+	for (size_t i = 0; i < n; i++){
+		long long wait;
+		if (sched_due(chs[i], now))
+			wait = 0;
+		else if (msense.refresh_ms)
+			wait = chs[i]->next_ts - now;
+		else
+			continue;
+
+		if (timeout == -1 || wait < timeout)
+			timeout = wait;
+	}
+
+/* out of budget, sleep until there is some again */
+	if (timeout == 0 && msense.budget && tokens <= 0)
+		timeout = 1 + (long long)(-tokens * 1000.0 / msense.budget);
+
+	return timeout > INT_MAX ? INT_MAX : timeout;
+}
+
+/*
+ * Refresh the due windows, round-robin so that no window starves when
+ * the budget runs out. The reads for all of them are batched into one
+ * scatter list and the tracee is only resumed once for the entire pass.
+ */
+static void sched_refresh(struct page_ch** chs, size_t n,
+	double* tokens, unsigned long long now)
+{
+	static struct mread_req* reqs;
+	static size_t reqs_cap;
+	static size_t rr;
+
+	size_t n_reqs = 0;
+	bool any = false;
 
+	for (size_t i = 0; i < n; i++){
+		struct page_ch* pch = chs[(rr + i) % n];
+		if (!sched_due(pch, now))
 			continue;
+
+		if (msense.budget && *tokens <= 0)
+			break;
+
+		size_t need = n_reqs + pch->n_pages + 1;
+		if (need > reqs_cap){
+			struct mread_req* nreqs = realloc(reqs, need * 2 * sizeof(struct mread_req));
+			if (!nreqs)
+				break;
+			reqs = nreqs;
+			reqs_cap = need * 2;
 		}
 
-		if (ev.category == EVENT_TARGET)
-		switch(ev.tgt.kind){
-		case TARGET_COMMAND_EXIT:
-			return NULL;
-		break;
-
-		case TARGET_COMMAND_STEPFRAME:{
-			ssize_t nc;
-			if (ev.tgt.ioevs[0].iv == 0){
-seek0:
-				nc = synch_copy(ch, pch->fd, buf, buf_sz);
-				if (0 == nc)
-					fprintf(stderr, "Couldn't read from ofset (%llu)\n",
-						(unsigned long long) cofs);
-
-				if (-1 == lseek64(pch->fd, -nc, SEEK_CUR)){
-					fprintf(stderr, "Couldn't reset FP after copy, code: %d\n", errno);
-					goto error;
-				}
-				cofs = lseek64(pch->fd, 0, SEEK_CUR);
-			}
-			else if (ev.tgt.ioevs[0].iv == 1){
-				if (cofs + buf_sz > pch->size){
-					lseek64(pch->fd, pch->size - buf_sz >pch->base ?
-						pch->base : pch->base + pch->size - buf_sz, SEEK_SET);
-				}
-				else
-					lseek64(pch->fd, buf_sz, SEEK_CUR);
-				goto seek0;
-			}
-			else if (ev.tgt.ioevs[0].iv == -1){
-				if (cofs - buf_sz > pch->base)
-					lseek64(pch->fd, cofs - buf_sz, SEEK_SET);
-				else
-					lseek64(pch->fd, pch->base, SEEK_SET);
-				goto seek0;
+		pch->req_ofs = n_reqs;
+		pch->n_reqs = refresh_prepare(pch, &reqs[n_reqs]);
+
+		for (size_t j = 0; j < pch->n_reqs; j++)
+			*tokens -= reqs[n_reqs + j].len;
+
+		n_reqs += pch->n_reqs;
+		pch->queued = any = true;
+	}
+
+	if (!any)
+		return;
+
+	rr = (rr + 1) % n;
+	mreader_read(msense.reader, reqs, n_reqs);
+
+#ifdef PTRACE_PRCTL
+	pthread_mutex_lock(&msense.plock);
+	ptrace(PTRACE_CONT, msense.pid, NULL, NULL);
+	pthread_mutex_unlock(&msense.plock);
+#endif
+
+	for (size_t i = 0; i < n; i++){
+		struct page_ch* pch = chs[i];
+		if (!pch->queued)
+			continue;
+
+		refresh_finish(pch, pch->channel->in, &reqs[pch->req_ofs]);
+		pch->next_ts = now + msense.refresh_ms;
+		pch->queued = false;
+	}
+}
+
+static void* sched_loop(void* arg)
+{
+	short pollev = POLLIN | POLLERR | POLLHUP | POLLNVAL;
+	struct page_ch** chs = NULL;
+	struct pollfd* fds = malloc(sizeof(struct pollfd));
+	size_t cap = 0;
+
+	unsigned long long last = arcan_timemillis();
+	double tokens = msense.budget;
+
+	while (1){
+/* the main thread only ever adds, closing happens here */
+		size_t n = 0;
+		pthread_mutex_lock(&msense.dlock);
+		for (struct page_ch* p = msense.tracked; p; p = p->next){
+			if (n == cap){
+				size_t ncap = cap ? cap * 2 : 8;
+				struct page_ch** nchs = realloc(chs, ncap * sizeof(struct page_ch*));
+				struct pollfd* nfds = realloc(fds, (ncap + 1) * sizeof(struct pollfd));
+				if (nchs)
+					chs = nchs;
+				if (nfds)
+					fds = nfds;
+				if (!nchs || !nfds)
+					break;
+				cap = ncap;
 			}
+			chs[n++] = p;
 		}
-		default:
-		break;
+		pthread_mutex_unlock(&msense.dlock);
+
+		for (size_t i = 0; i < n; i++)
+			if (!chs[i]->buf && !sched_init(chs[i])){
+				fprintf(stderr, "couldn't setup window at (%" PRIxPTR ")\n",
+					chs[i]->base);
+				sched_close(chs[i]);
+				chs[i--] = chs[--n];
+			}
+
+		unsigned long long now = arcan_timemillis();
+		if (msense.budget){
+			tokens += (double)(now - last) * msense.budget / 1000.0;
+			if (tokens > msense.budget)
+				tokens = msense.budget;
 		}
+		last = now;
+
+		sched_refresh(chs, n, &tokens, now);
+
+		fds[0] = (struct pollfd){.fd = msense.wake[0], .events = pollev};
+		for (size_t i = 0; i < n; i++)
+			fds[i+1] = (struct pollfd){
+				.fd = chs[i]->channel->in->context(chs[i]->channel->in)->epipe,
+				.events = pollev
+			};
+
+		poll(fds, n + 1, sched_timeout(chs, n, tokens, arcan_timemillis()));
+
+/* non-blocking, just flush */
+		char ign[64];
+		while (read(msense.wake[0], ign, sizeof(ign)) > 0)
+			;
+
+		for (size_t i = 0; i < n; i++)
+			if (fds[i+1].revents && !sched_events(chs[i]))
+				sched_close(chs[i]);
 	}
 
-error:
-	pch->channel->close(pch->channel);
-	free(th_data);
 	return NULL;
 }
 
-static FILE* get_map_descr(pid_t pid)
+static void setup_sched(struct arg_arr* aarr)
+{
+	const char* val;
+	if (aarr && arg_lookup(aarr, "refresh", 0, &val))
+		msense.refresh_ms = strtoul(val, NULL, 10);
+
+	if (aarr && arg_lookup(aarr, "budget", 0, &val))
+		msense.budget = strtoul(val, NULL, 10);
+
+	pthread_t pth;
+	if (-1 == pipe(msense.wake)){
+		fprintf(stderr, "couldn't create scheduler wakeup pipe (%s), "
+			"page inspection disabled\n", strerror(errno));
+		msense.wake[0] = msense.wake[1] = -1;
+		msense.ptrace = false;
+		return;
+	}
+
+	fcntl(msense.wake[0], F_SETFL, O_NONBLOCK);
+	fcntl(msense.wake[1], F_SETFL, O_NONBLOCK);
+	if (0 != pthread_create(&pth, NULL, sched_loop, NULL)){
+		fprintf(stderr, "couldn't spawn scheduler thread, "
+			"page inspection disabled\n");
+		msense.ptrace = false;
+	}
+}
+
+/*
+ * clear_refs accepts "4" even on kernels without CONFIG_MEM_SOFT_DIRTY,
+ * so check that a write to one of our own pages actually gets marked
+ */
+static bool softdirty_probe()
+{
+	bool rv = false;
+	int pm = open("/proc/self/pagemap", O_RDONLY);
+	int cr = open("/proc/self/clear_refs", O_WRONLY);
+	volatile uint8_t* page = mmap(NULL, msense.page_sz,
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (-1 == pm || -1 == cr || MAP_FAILED == page)
+		goto out;
+
+	page[0] = 1;
+	uint64_t ent;
+	off_t ofs = ((uintptr_t)page / msense.page_sz) * sizeof(uint64_t);
+	if (write(cr, "4", 1) != 1)
+		goto out;
+
+	page[0] = 2;
+	rv = pread(pm, &ent, sizeof(ent), ofs) == sizeof(ent) && (ent & PM_SOFT_DIRTY);
+
+out:
+	if (-1 != pm)
+		close(pm);
+	if (-1 != cr)
+		close(cr);
+	if (MAP_FAILED != page)
+		munmap((void*)page, msense.page_sz);
+	return rv;
+}
+
+/*
+ * hashing is the default as soft-dirty needs write access to clear_refs
+ * and resets the bits for everyone else tracking the process
+ */
+static void setup_delta(struct arg_arr* aarr)
+{
+	const char* val;
+	if (!aarr)
+		return;
+
+	if (arg_lookup(aarr, "nodelta", 0, &val)){
+		msense.delta = DELTA_OFF;
+		return;
+	}
+
+	if (!arg_lookup(aarr, "softdirty", 0, &val))
+		return;
+
+	if (!softdirty_probe()){
+		fprintf(stderr, "soft-dirty bits not supported, using page hashes\n");
+		return;
+	}
+
+	char wbuf[sizeof("/proc//clear_refs") + 8];
+	snprintf(wbuf, sizeof(wbuf), "/proc/%d/pagemap", (int) msense.pid);
+	msense.pagemap_fd = open(wbuf, O_RDONLY);
+	snprintf(wbuf, sizeof(wbuf), "/proc/%d/clear_refs", (int) msense.pid);
+	msense.clear_refs_fd = open(wbuf, O_WRONLY);
+
+	if (-1 == msense.pagemap_fd || -1 == msense.clear_refs_fd){
+		fprintf(stderr, "couldn't open pagemap/clear_refs (%s), "
+			"using page hashes\n", strerror(errno));
+		return;
+	}
+
+	msense.delta = DELTA_SOFTDIRTY;
+}
+
+/*
+ * One entry per selectable /proc/pid/maps line, kept sorted by address
+ * (the order the kernel provides) so snapshots can be diffed in one pass.
+ */
+struct region {
+	uintptr_t addr, endaddr;
+	uint64_t offset, inode;
+	char perm[5];
+
+/* appeared (or changed permissions) in the last refresh */
+	bool fresh;
+};
+
+static struct {
+	struct region* tbl;
+	size_t count, cap;
+
+/* previous table, parsed into on the next refresh */
+	struct region* spare;
+	size_t spare_cap;
+
+/* raw file contents, grows to fit and is reused between refreshes */
+	char* buf;
+	size_t buf_sz;
+} regions;
+
+static const char* scan_hex(const char* p, const char* end, uint64_t* out)
+{
+	uint64_t v = 0;
+	for (; p < end; p++){
+		if (*p >= '0' && *p <= '9')
+			v = (v << 4) | (*p - '0');
+		else if (*p >= 'a' && *p <= 'f')
+			v = (v << 4) | (*p - 'a' + 10);
+		else
+			break;
+	}
+	*out = v;
+	return p;
+}
+
+static const char* scan_dec(const char* p, const char* end, uint64_t* out)
+{
+	uint64_t v = 0;
+	for (; p < end && *p >= '0' && *p <= '9'; p++)
+		v = v * 10 + (*p - '0');
+	*out = v;
+	return p;
+}
+
+static const char* skip_field(const char* p, const char* end)
+{
+	while (p < end && *p != ' ' && *p != '\n')
+		p++;
+	while (p < end && *p == ' ')
+		p++;
+	return p;
+}
+
+/* procfs doesn't report a size, read until EOF into the reusable buffer */
+static ssize_t read_maps()
 {
 	char wbuf[sizeof("/proc//maps") + 8];
 	snprintf(wbuf, sizeof(wbuf), "/proc/%d/maps", (int) msense.pid);
-	FILE* fpek = fopen(wbuf, "r");
-	return fpek;
+	int fd = open(wbuf, O_RDONLY);
+	if (-1 == fd)
+		return -1;
+
+	size_t ofs = 0;
+	for(;;){
+		if (ofs == regions.buf_sz){
+			size_t nsz = regions.buf_sz ? regions.buf_sz * 2 : 65536;
+			char* nbuf = realloc(regions.buf, nsz);
+			if (!nbuf){
+				close(fd);
+				return -1;
+			}
+			regions.buf = nbuf;
+			regions.buf_sz = nsz;
+		}
+
+		ssize_t nr = read(fd, regions.buf + ofs, regions.buf_sz - ofs);
+		if (-1 == nr && errno == EINTR)
+			continue;
+		if (nr <= 0)
+			break;
+		ofs += nr;
+	}
+
+	close(fd);
+	return ofs;
 }
 
 /*
- * more complex here than in other senses due to the dynamic
- * nature of proc/pid/maps and that the currently selected
- * item won't fit in the allocated output buffer.
+ * Parse the maps snapshot into tbl, lines are on the form:
+ * start-end perm offset major:minor inode [path]
+ */
+static size_t parse_maps(const char* p, const char* end,
+	struct region** tbl, size_t* cap)
+{
+	size_t count = 0;
+
+	while (p < end){
+		const char* eol = memchr(p, '\n', end - p);
+		eol = eol ? eol : end;
+
+		struct region r = {0};
+		uint64_t a, b;
+		const char* cur = scan_hex(p, eol, &a);
+		if (cur == eol || *cur != '-')
+			goto next;
+		cur = scan_hex(cur + 1, eol, &b);
+		if (cur == eol || *cur++ != ' ' || eol - cur < 4)
+			goto next;
+
+		memcpy(r.perm, cur, 4);
+		cur = skip_field(cur, eol);
+		cur = scan_hex(cur, eol, &r.offset);
+		cur = skip_field(skip_field(cur, eol), eol);
+		scan_dec(cur, eol, &r.inode);
+		r.addr = a;
+		r.endaddr = b;
+
+		if (msense.skip_inode && r.inode != 0)
+			goto next;
+
+		if (count == *cap){
+			size_t ncap = *cap ? *cap * 2 : 256;
+			struct region* ntbl = realloc(*tbl, ncap * sizeof(struct region));
+			if (!ntbl)
+				break;
+			*tbl = ntbl;
+			*cap = ncap;
+		}
+		(*tbl)[count++] = r;
+
+next:
+		p = eol + 1;
+	}
+
+	return count;
+}
+
+/*
+ * Merge-walk the old and the new table and flag the regions that are new,
+ * both are sorted on address. Returns the number of new regions and sets
+ * *gone to the number of ones that disappeared.
+ */
+static size_t diff_regions(struct region* old, size_t n_old,
+	struct region* cur, size_t n_cur, size_t* gone)
+{
+	size_t i = 0, j = 0, added = 0;
+	*gone = 0;
+
+	while (i < n_cur || j < n_old){
+		if (j == n_old || (i < n_cur && cur[i].addr < old[j].addr)){
+			cur[i++].fresh = true;
+			added++;
+		}
+		else if (i == n_cur || old[j].addr < cur[i].addr){
+			j++;
+			(*gone)++;
+		}
+		else {
+			bool same = cur[i].endaddr == old[j].endaddr &&
+				memcmp(cur[i].perm, old[j].perm, 4) == 0;
+			cur[i].fresh = !same;
+			added += !same;
+			*gone += !same;
+			i++, j++;
+		}
+	}
+
+	return added;
+}
+
+/*
+ * Reparse /proc/pid/maps and diff against the previous snapshot. The
+ * selection follows the region it was on when it is still mapped. Keeps
+ * the old table if the process can't be read anymore.
+ */
+static bool refresh_regions(bool report)
+{
+	ssize_t nb = read_maps();
+	if (-1 == nb){
+		fprintf(stderr, "couldn't read /proc/%d/maps (%s)\n",
+			(int) msense.pid, strerror(errno));
+		return false;
+	}
+
+	size_t count = parse_maps(regions.buf,
+		regions.buf + nb, &regions.spare, &regions.spare_cap);
+	struct region* next = regions.spare;
+
+	size_t gone;
+	size_t added = diff_regions(regions.tbl, regions.count, next, count, &gone);
+
+	if (report && (added || gone)){
+		arcan_event ev = {
+			.category = EVENT_EXTERNAL,
+			.ext.kind = EVENT_EXTERNAL_MESSAGE
+		};
+		snprintf((char*)ev.ext.message, sizeof(ev.ext.message) /
+			sizeof(ev.ext.message[0]), "maps:%zu:%zu", added, gone);
+		arcan_shmif_enqueue(msense.cont->context(msense.cont), &ev);
+	}
+
+	if (!report)
+		for (size_t i = 0; i < count; i++)
+			next[i].fresh = false;
+
+/* find the selected region in the new table */
+	if (regions.count && msense.sel >= 0 && msense.sel < regions.count){
+		uintptr_t addr = regions.tbl[msense.sel].addr;
+		for (size_t i = 0; i < count; i++)
+			if (next[i].addr >= addr){
+				msense.sel = i;
+				break;
+			}
+	}
+
+	regions.spare = regions.tbl;
+	regions.tbl = next;
+	size_t cap = regions.cap;
+	regions.cap = regions.spare_cap;
+	regions.spare_cap = cap;
+	regions.count = count;
+
+	return true;
+}
+
+/*
+ * Draw the current region table, regions that appeared on the last
+ * refresh are marked next to the cursor column.
  */
 static void update_preview(shmif_pixel ccol)
 {
@@ -314,49 +1174,11 @@ static void update_preview(shmif_pixel ccol)
   draw_text(c, "wx ", col*(fontw+1), 0, RGBA(0x55, 0xff, 0xff, 0xff));col += 3;
 	draw_text(c, "rwx", col*(fontw+1), 0, RGBA(0xff, 0xff, 0xff, 0xff));
 
-	FILE* fpek = get_map_descr(msense.pid);
-	if (!fpek){
-		fprintf(stderr, "couldn't open proc/pid/maps for reading.\n");
-		exit(EXIT_FAILURE);
-	}
-
-	struct page {
-		long long addr, endaddr, offset, inode;
-		char perm[6];
- 		char device[16];
-	};
-
-/* populate list of entries, first get limit */
-	size_t count;
-	for (count = 0; !feof(fpek); count++)
-		while(fgetc(fpek) != '\n' && !feof(fpek))
-			;
-	fseek(fpek, 0, SEEK_SET);
-
-/* then fill VLA of page struct with the interesting ones,
- * need to be careful about TOCTU overflow */
-	struct page pcache[count];
-	memset(pcache, '\0', sizeof(struct page) * count);
-
-	size_t ofs = 0;
-	while(!feof(fpek) && ofs < count){
-		int ret = fscanf(fpek, "%llx-%llx %5s %llx %5s %llx",
-			&pcache[ofs].addr, &pcache[ofs].endaddr, pcache[ofs].perm,
-			&pcache[ofs].offset, pcache[ofs].device, &pcache[ofs].inode);
-
-		if (0 == ret){
-				while (fgetc(fpek) != '\n' && !feof(fpek))
-					;
-			continue;
-		}
-
-		if (!msense.skip_inode || (msense.skip_inode && pcache[ofs].inode == 0))
-			ofs++;
-	}
-	if (0 == ofs)
+	size_t count = regions.count;
+	if (0 == count){
+		arcan_shmif_signal(c, SHMIF_SIGVID);
 		return;
-
-	count = ofs-1;
+	}
 
 /* clamp */
 	if (msense.sel >= count)
@@ -370,34 +1192,32 @@ static void update_preview(shmif_pixel ccol)
  	if (msense.sel > 0)
 		page = msense.sel / nl;
 
-	ofs = page * nl;
+	size_t ofs = page * nl;
 
 	int y = fonth + 1;
 	int cc = msense.sel % nl;
 
-/* each step requires reprocessing the proc entry, expensive
- * but provides a somewhat more accurate view (inotify etc. doesn't
- * do anything on proc, so other option to work with a cache would
- * be to take advantage of ptrace. */
-
 	while (y < c->addr->h && ofs < count){
-		uint8_t r = pcache[ofs].perm[0] == 'r' ? 0xff : 0x55;
-		uint8_t g = pcache[ofs].perm[1] == 'w' ? 0xff : 0x55;
-		uint8_t b = pcache[ofs].perm[2] == 'x' ? 0xff : 0x55;
+		struct region* r = &regions.tbl[ofs];
+		uint8_t cr = r->perm[0] == 'r' ? 0xff : 0x55;
+		uint8_t cg = r->perm[1] == 'w' ? 0xff : 0x55;
+		uint8_t cb = r->perm[2] == 'x' ? 0xff : 0x55;
 
 		if (cc == 0){
-			msense.sel_base = pcache[ofs].addr + pcache[ofs].offset;
-			msense.sel_size = pcache[ofs].endaddr - pcache[ofs].addr;
+			msense.sel_base = r->addr + r->offset;
+			msense.sel_size = r->endaddr - r->addr;
 			cc--;
 		}
 		else if (cc > 0)
 			cc--;
+		if (r->fresh)
+			draw_box(c, 0, y, fontw, fonth, RGBA(0xff, 0xaa, 0x00, 0xff));
 
 /* draw addr + text in fitting color */
 		char wbuf[256];
-		shmif_pixel col = RGBA(r, g, b, 0xff);
-		snprintf(wbuf, 256, "%llx(%dk)", pcache[ofs].addr,
-			(int)((pcache[ofs].endaddr - pcache[ofs].addr) / 1024));
+		shmif_pixel col = RGBA(cr, cg, cb, 0xff);
+		snprintf(wbuf, 256, "%" PRIxPTR "(%dk)", r->addr,
+			(int)((r->endaddr - r->addr) / 1024));
 
 		draw_text(c, wbuf, fontw + 1, y, col);
 		y += fonth + 1;
@@ -405,7 +1225,6 @@ static void update_preview(shmif_pixel ccol)
 	}
 
 	draw_box(c, 0, ((msense.sel % nl)+1) * (fonth+1), fontw, fonth, ccol);
-	fclose(fpek);
 	arcan_shmif_signal(c, SHMIF_SIGVID);
 }
 
@@ -421,13 +1240,8 @@ int main(int argc, char* argv[])
 
 	msense.pid = strtol(argv[1], NULL, 10);
 
-	FILE* fp = get_map_descr(msense.pid);
-	if (!fp){
-		fprintf(stderr, "Couldn't open /proc/%d/maps, reason: %s\n",
-			(int) msense.pid, strerror(errno));
+	if (!refresh_regions(false))
 		return EXIT_FAILURE;
-	}
-	fclose(fp);
 
 	if (!senseye_connect(NULL, stderr, &cont, &aarr))
 		return EXIT_FAILURE;
@@ -453,7 +1267,12 @@ int main(int argc, char* argv[])
 #endif
 
 	msense.cont = &cont;
+	msense.reader = mreader_open(msense.pid);
+	msense.page_sz = sysconf(_SC_PAGESIZE);
 	pthread_mutex_init(&msense.plock, NULL);
+	pthread_mutex_init(&msense.dlock, NULL);
+	setup_delta(aarr);
+	setup_sched(aarr);
 	update_preview(RGBA(0x00, 0xff, 0x00, 0xff));
 
 	cont.dispatch = control_event;
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2015, Björn Ståhl
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: process_vm_readv / pread based memory reader for msense,
+ * see msense_read.h for the interface.
+ */
+#define _GNU_SOURCE
+#define _LARGEFILE64_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+
+#include "msense_read.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+struct mreader {
+	pid_t pid;
+	int fd;
+	size_t page_sz;
+
+/* cleared (once) if process_vm_readv turns out to be unusable */
+	bool vm;
+};
+
+struct mreader* mreader_open(pid_t pid)
+{
+	struct mreader* rd = malloc(sizeof(struct mreader));
+	if (!rd)
+		return NULL;
+
+	char wbuf[sizeof("/proc//mem") + 8];
+	snprintf(wbuf, sizeof(wbuf), "/proc/%d/mem", (int) pid);
+
+	rd->pid = pid;
+	rd->fd = open(wbuf, O_RDONLY);
+	rd->page_sz = sysconf(_SC_PAGESIZE);
+	rd->vm = true;
+
+	if (-1 == rd->fd)
+		fprintf(stderr, "mreader_open(%d), couldn't open %s (%s), "
+			"process_vm_readv only\n", (int) pid, wbuf, strerror(errno));
+
+	return rd;
+}
+
+static bool vm_usable(struct mreader* rd)
+{
+	return __atomic_load_n(&rd->vm, __ATOMIC_RELAXED);
+}
+
+/* errors that mean process_vm_readv will never work for this process */
+static bool vm_fatal(int err)
+{
+	return err == ENOSYS || err == EPERM;
+}
+
+static ssize_t read_one(struct mreader* rd, uintptr_t addr, uint8_t* buf, size_t len)
+{
+	if (vm_usable(rd)){
+		struct iovec l = {.iov_base = buf, .iov_len = len};
+		struct iovec r = {.iov_base = (void*) addr, .iov_len = len};
+		ssize_t nr = process_vm_readv(rd->pid, &l, 1, &r, 1, 0);
+		if (nr >= 0 || !vm_fatal(errno))
+			return nr;
+
+		__atomic_store_n(&rd->vm, false, __ATOMIC_RELAXED);
+	}
+
+	if (-1 == rd->fd)
+		return -1;
+
+	ssize_t nr;
+	while (-1 == (nr = pread64(rd->fd, buf, len, addr)) && errno == EINTR)
+		;
+	return nr;
+}
+
+/*
+ * complete a request from req->nr onwards one page at a time, so that
+ * a hole in the middle doesn't lose the rest of the range
+ */
+static void read_pages(struct mreader* rd, struct mread_req* req)
+{
+	size_t pos = req->nr;
+
+	while (pos < req->len){
+		uintptr_t addr = req->addr + pos;
+		size_t n = rd->page_sz - (addr % rd->page_sz);
+		n = n > req->len - pos ? req->len - pos : n;
+
+		ssize_t nr = read_one(rd, addr, req->buf + pos, n);
+		nr = nr < 0 ? 0 : nr;
+		req->nr += nr;
+
+		if (nr < n)
+			memset(req->buf + pos + nr, '\0', n - nr);
+		pos += n;
+	}
+}
+
+size_t mreader_read(struct mreader* rd, struct mread_req* reqs, size_t n)
+{
+	struct iovec local[IOV_MAX];
+	struct iovec remote[IOV_MAX];
+	size_t ofs = 0;
+	size_t total = 0;
+
+	for (size_t i = 0; i < n; i++)
+		reqs[i].nr = 0;
+
+	while (ofs < n){
+		size_t cnt = n - ofs > IOV_MAX ? IOV_MAX : n - ofs;
+		ssize_t nr = -1;
+
+		if (vm_usable(rd)){
+			for (size_t i = 0; i < cnt; i++){
+				local[i].iov_base = reqs[ofs + i].buf;
+				local[i].iov_len = reqs[ofs + i].len;
+				remote[i].iov_base = (void*) reqs[ofs + i].addr;
+				remote[i].iov_len = reqs[ofs + i].len;
+			}
+
+			nr = process_vm_readv(rd->pid, local, cnt, remote, cnt, 0);
+			if (-1 == nr && vm_fatal(errno))
+				__atomic_store_n(&rd->vm, false, __ATOMIC_RELAXED);
+		}
+
+/* no batch, resolve one at a time (pread or the fatal case above) */
+		if (-1 == nr){
+			struct mread_req* req = &reqs[ofs++];
+			ssize_t nr = read_one(rd, req->addr, req->buf, req->len);
+			req->nr = nr < 0 ? 0 : nr;
+			if (req->nr < req->len)
+				read_pages(rd, req);
+			total += req->nr;
+			continue;
+		}
+
+/* a short transfer stops at the first request that couldn't be read,
+ * finish that one page-wise and batch the rest again */
+		size_t left = nr;
+		for (; cnt && left >= reqs[ofs].len; cnt--, ofs++){
+			reqs[ofs].nr = reqs[ofs].len;
+			left -= reqs[ofs].len;
+			total += reqs[ofs].len;
+		}
+
+		if (cnt){
+			struct mread_req* req = &reqs[ofs++];
+			req->nr = left;
+			read_pages(rd, req);
+			total += req->nr;
+		}
+	}
+
+	return total;
+}
+
+void mreader_close(struct mreader* rd)
+{
+	if (!rd)
+		return;
+
+	if (-1 != rd->fd)
+		close(rd->fd);
+	free(rd);
+}
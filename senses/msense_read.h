@@ -0,0 +1,33 @@
+/*
+ * Copyright 2015, Björn Ståhl
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Memory reader for msense. Reads are batched as scatter
+ * lists into process_vm_readv, with pread on /proc/pid/mem as fallback
+ * when that is not permitted or available. Neither keeps any file
+ * position so one reader can be shared between threads without locking.
+ */
+
+struct mread_req {
+	uintptr_t addr;
+	size_t len;
+	uint8_t* buf;
+
+/* set by the reader to the number of bytes that could be read */
+	size_t nr;
+};
+
+struct mreader;
+
+/* returns NULL on allocation failure, access problems show up as reads
+ * that come back zero-filled */
+struct mreader* mreader_open(pid_t pid);
+
+/*
+ * Read n requests, as few syscalls as possible. Pages that can't be read
+ * (unmapped while reading, guard pages, ...) are zero-filled in buf.
+ * Returns the total number of bytes that could be read.
+ */
+size_t mreader_read(struct mreader*, struct mread_req* reqs, size_t n);
+
+void mreader_close(struct mreader*);
@@ -6,6 +6,7 @@
  * signal around a transfer channel connected to STDIN, sampling and
  * forwarding on STDOUT.
  */
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <inttypes.h>
@@ -14,15 +15,34 @@
 #include <poll.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <string.h>
+#include <pthread.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 
 #include <arcan_shmif.h>
 #include "senseye.h"
+#include "rwstat.h"
 
 static size_t inp_buf_sz = 1024 * 1;
 static struct arcan_shmif_cont* shm;
 
+/*
+ * splice mode, forwarding is done with tee/splice so the data never enters
+ * user space, only the first inp_buf_sz bytes of each chunk are copied out
+ * for sampling. loop is used to tee when STDOUT is not a pipe.
+ */
+static struct {
+	bool enabled;
+	bool out_pipe;
+	int loop[2];
+	int null;
+} zc = {
+	.loop = {-1, -1},
+	.null = -1
+};
+
 bool control_refresh(shmif_pixel* vidp, size_t w, size_t h)
 {
 	return false;
@@ -33,6 +53,280 @@ void control_event(arcan_event* ev)
 
 }
 
+static bool write_all(int fd, const uint8_t* buf, size_t nb)
+{
+	size_t ofs = 0;
+	while (nb - ofs > 0){
+		ssize_t nw = write(fd, buf + ofs, nb - ofs);
+		if (-1 == nw){
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			return false;
+		}
+		ofs += nw;
+	}
+	return true;
+}
+
+/* move exactly nb bytes from one pipe end to fd (or discard them) */
+static bool splice_all(int in, int out, size_t nb)
+{
+	while (nb > 0){
+		ssize_t ns = splice(in, NULL, out, NULL, nb, SPLICE_F_MOVE);
+		if (-1 == ns){
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			return false;
+		}
+		if (0 == ns)
+			return false;
+		nb -= ns;
+	}
+	return true;
+}
+
+/*
+ * Forward whatever is pending on STDIN and copy the head of it into buf,
+ * returns the number of bytes sampled, 0 on EOF and -1 on failure.
+ */
+static ssize_t splice_step(uint8_t* buf, size_t buf_sz)
+{
+	int dst = zc.out_pipe ? STDOUT_FILENO : zc.loop[1];
+	ssize_t nt;
+	while (-1 == (nt = tee(STDIN_FILENO, dst, 64 * 1024, 0)) &&
+		(errno == EAGAIN || errno == EINTR))
+		;
+
+	if (nt <= 0)
+		return nt;
+
+/* src is now the second copy, the one in STDIN when tee:d to STDOUT */
+	int src = STDIN_FILENO;
+	if (!zc.out_pipe){
+		if (!splice_all(STDIN_FILENO, STDOUT_FILENO, nt))
+			return -1;
+		src = zc.loop[0];
+	}
+
+	ssize_t nr = 0;
+	while (nr < nt && nr < buf_sz){
+		ssize_t rv = read(src, buf + nr, (nt < buf_sz ? nt : buf_sz) - nr);
+		if (-1 == rv){
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (0 == rv)
+			break;
+		nr += rv;
+	}
+
+	if (nt > nr && !splice_all(src, zc.null, nt - nr))
+		return -1;
+
+	return nr;
+}
+
+/*
+ * tee needs both ends to be pipes, with a non-pipe STDOUT we tee into a
+ * pipe of our own and splice STDIN to STDOUT.
+ */
+static bool setup_splice()
+{
+	struct stat in, out;
+	if (-1 == fstat(STDIN_FILENO, &in) || !S_ISFIFO(in.st_mode)){
+		fprintf(stderr, "splice mode needs STDIN to be a pipe, disabled.\n");
+		return false;
+	}
+
+	if (-1 == fstat(STDOUT_FILENO, &out))
+		return false;
+
+	zc.out_pipe = S_ISFIFO(out.st_mode);
+	if (!zc.out_pipe && -1 == pipe(zc.loop)){
+		fprintf(stderr, "splice mode, couldn't create pipe, disabled.\n");
+		return false;
+	}
+
+	zc.null = open("/dev/null", O_WRONLY);
+	if (-1 == zc.null){
+		fprintf(stderr, "splice mode, couldn't open /dev/null, disabled.\n");
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * tap mode, the forwarder never waits for the UI: sampled bytes go into a
+ * ring that a separate thread feeds to the channel, the oldest bytes are
+ * overwritten (and counted as dropped) when it falls behind.
+ */
+static struct {
+	bool enabled;
+	uint8_t* buf;
+	size_t sz, head, used;
+	size_t dropped;
+	bool dead;
+	pthread_mutex_t lock;
+	int wake[2];
+} tap = {
+	.sz = 1024 * 1024
+};
+
+static void tap_push(const uint8_t* buf, size_t nb)
+{
+	pthread_mutex_lock(&tap.lock);
+	if (nb > tap.sz){
+		tap.dropped += nb - tap.sz;
+		buf += nb - tap.sz;
+		nb = tap.sz;
+	}
+
+	if (tap.used + nb > tap.sz){
+		size_t over = tap.used + nb - tap.sz;
+		tap.dropped += over;
+		tap.used -= over;
+	}
+
+	size_t first = tap.sz - tap.head < nb ? tap.sz - tap.head : nb;
+	memcpy(&tap.buf[tap.head], buf, first);
+	memcpy(tap.buf, buf + first, nb - first);
+	tap.head = (tap.head + nb) % tap.sz;
+	tap.used += nb;
+	pthread_mutex_unlock(&tap.lock);
+
+/* non-blocking, a full pipe means there is a wakeup pending already */
+	char ign = 1;
+	write(tap.wake[1], &ign, 1);
+}
+
+/* take the oldest nb bytes and the number of bytes dropped since last */
+static size_t tap_pull(uint8_t* buf, size_t nb, size_t* dropped, bool* dead)
+{
+	pthread_mutex_lock(&tap.lock);
+	if (nb > tap.used)
+		nb = tap.used;
+
+	size_t tail = (tap.head + tap.sz - tap.used) % tap.sz;
+	size_t first = tap.sz - tail < nb ? tap.sz - tail : nb;
+	memcpy(buf, &tap.buf[tail], first);
+	memcpy(buf + first, tap.buf, nb - first);
+	tap.used -= nb;
+
+	*dropped = tap.dropped;
+	tap.dropped = 0;
+	*dead = tap.dead && tap.used == 0;
+	pthread_mutex_unlock(&tap.lock);
+
+	return nb;
+}
+
+static void tap_close()
+{
+	pthread_mutex_lock(&tap.lock);
+	tap.dead = true;
+	pthread_mutex_unlock(&tap.lock);
+
+	char ign = 1;
+	write(tap.wake[1], &ign, 1);
+}
+
+static bool setup_tap()
+{
+	tap.buf = malloc(tap.sz);
+	if (!tap.buf || -1 == pipe(tap.wake)){
+		fprintf(stderr, "tap mode, couldn't allocate ring buffer, disabled.\n");
+		free(tap.buf);
+		return false;
+	}
+
+	fcntl(tap.wake[0], F_SETFL, O_NONBLOCK);
+	fcntl(tap.wake[1], F_SETFL, O_NONBLOCK);
+	pthread_mutex_init(&tap.lock, NULL);
+	return true;
+}
+
+static void* channel_dead(struct senseye_ch* ch, uint8_t* buffer)
+{
+	for (size_t i = 0; i < shm->addr->w * shm->addr->h; i++)
+		shm->vidp[i] = RGBA(0xff, 0x00, 0x00, 0xff);
+	arcan_shmif_signal(shm, SHMIF_SIGVID);
+
+	free(buffer);
+	ch->close(ch);
+	return NULL;
+}
+
+/* feeds the channel from the ring, this is the only thread touching it */
+static void* tap_loop(void* ptr)
+{
+	struct senseye_ch* ch = ptr;
+	short pollev = POLLIN | POLLERR | POLLHUP | POLLNVAL;
+	struct pollfd fds[2] = {
+		{	.fd = tap.wake[0], .events = pollev },
+		{ .fd = ch->in_handle, .events = pollev }
+	};
+
+	uint8_t* buffer = malloc(inp_buf_sz);
+	if (!buffer)
+		return channel_dead(ch, buffer);
+
+	while (1){
+		if (-1 == poll(fds, 2, -1) && (errno == EAGAIN || errno == EINTR))
+			continue;
+
+		char ign[64];
+		while (read(tap.wake[0], ign, sizeof(ign)) > 0)
+			;
+
+		if ( (fds[1].revents & POLLIN) > 0)
+			ch->pump(ch);
+
+/* may block while the UI is paused, the ring keeps the latest data */
+		bool dead;
+		for(;;){
+			size_t dropped;
+			size_t nr = tap_pull(buffer, inp_buf_sz, &dropped, &dead);
+			if (dropped)
+				ch->in->drop(ch->in, dropped);
+			if (!nr)
+				break;
+			ch->data(ch, buffer, nr);
+		}
+
+		if (dead || (fds[1].revents & (POLLERR | POLLHUP | POLLNVAL)))
+			return channel_dead(ch, buffer);
+	}
+
+	return NULL;
+}
+
+/* plain or spliced forwarding only, the channel belongs to tap_loop */
+static void forward_loop(uint8_t* buffer)
+{
+	while (1){
+		ssize_t nr;
+		if (zc.enabled)
+			nr = splice_step(buffer, inp_buf_sz);
+		else {
+			nr = read(STDIN_FILENO, buffer, inp_buf_sz);
+			if (-1 == nr && (errno == EAGAIN || errno == EINTR))
+				continue;
+			if (nr > 0 && !write_all(STDOUT_FILENO, buffer, nr))
+				nr = -1;
+		}
+
+		if (nr <= 0)
+			break;
+
+		tap_push(buffer, nr);
+	}
+
+	free(buffer);
+	tap_close();
+}
+
 void* data_loop(void* ptr)
 {
 	struct senseye_ch* ch = ptr;
@@ -53,6 +347,19 @@ void* data_loop(void* ptr)
 		{ .fd = ch->in_handle, .events = pollev }
 	};
 
+	uint8_t* buffer = malloc(inp_buf_sz);
+	if (!buffer)
+		return channel_dead(ch, buffer);
+
+	if (tap.enabled){
+		pthread_t pth;
+		if (0 == pthread_create(&pth, NULL, tap_loop, ch)){
+			forward_loop(buffer);
+			return NULL;
+		}
+		fprintf(stderr, "tap mode, couldn't spawn thread, disabled.\n");
+	}
+
 	while (1){
 		int sv = poll(fds, 2, -1);
 
@@ -65,8 +372,17 @@ void* data_loop(void* ptr)
 		if ( (fds[1].revents & POLLIN) > 0)
 			ch->pump(ch);
 
-		if ( (fds[0].revents | POLLIN) ){
-			size_t buffer[inp_buf_sz];
+		if ( (fds[0].revents & POLLIN) ){
+/* forwarded before sampling, the pipe doesn't wait for the UI */
+			if (zc.enabled){
+				ssize_t nr = splice_step(buffer, inp_buf_sz);
+				if (nr <= 0)
+					return channel_dead(ch, buffer);
+
+				ch->data(ch, buffer, nr);
+				continue;
+			}
+
 			ssize_t nr = read(STDIN_FILENO, buffer, inp_buf_sz);
 
 /* will block / wait until the user has stepped through and processed */
@@ -74,27 +390,15 @@ void* data_loop(void* ptr)
 				ch->data(ch, buffer, nr);
 
 /* flush to output */
-				off_t ofs = 0;
-				while (nr - ofs > 0){
-					ssize_t nw = write(STDOUT_FILENO, buffer + ofs, nr - ofs);
-					if (-1 == nw && errno != EAGAIN && errno != EINTR)
-						goto error;
-					ofs += nw;
-				}
+				if (!write_all(STDOUT_FILENO, buffer, nr))
+					return channel_dead(ch, buffer);
 			}
 		}
 
 /* any errors or dead? */
 		if ( ((fds[0].revents | fds[1].revents )
-			& ( POLLERR | POLLHUP | POLLNVAL ) ) > 0){
-error:
-		for (size_t i = 0; i < shm->addr->w * shm->addr->h; i++)
-			shm->vidp[i] = RGBA(0xff, 0x00, 0x00, 0xff);
-				arcan_shmif_signal(shm, SHMIF_SIGVID);
-
-			ch->close(ch);
-			return NULL;
-		}
+			& ( POLLERR | POLLHUP | POLLNVAL ) ) > 0)
+			return channel_dead(ch, buffer);
 	}
 
 	return NULL;
@@ -138,6 +442,17 @@ int main(int argc, char* argv[])
 			size_t bv = strtoul(val, NULL, 10);
 			inp_buf_sz = bv > 65536 || bv == 0 ? 64 * 1024 : bv;
 		}
+
+		if (arg_lookup(aarr, "splice", 0, &val))
+			zc.enabled = setup_splice();
+
+		if (arg_lookup(aarr, "tap_size", 0, &val)){
+			size_t bv = strtoul(val, NULL, 10);
+			tap.sz = bv < inp_buf_sz ? inp_buf_sz : bv;
+		}
+
+		if (arg_lookup(aarr, "tap", 0, &val))
+			tap.enabled = setup_tap();
 	}
 
 	struct senseye_ch* ch = senseye_open(&cont, "STDIN", base);
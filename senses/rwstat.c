@@ -12,21 +12,54 @@
 #include <string.h>
 #include <assert.h>
 #include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
 
 #include <arcan_shmif.h>
 
 #include "rwstat.h"
+#include "rwstat_pack.h"
 
 struct pattern {
 	uint8_t* buf;
 	size_t buf_sz;
-	size_t buf_pos;
 	int evc;
+/* offset of the earliest match start in the current frame */
+	size_t first;
+/* hits in everything ingested since the last frame, RW_CLK_TIMED */
+	int tevc;
 	uint8_t alpha;
 	uint32_t id;
 	enum ptn_flags flags;
 };
 
+/*
+ * Aho-Corasick automaton compiled from the pattern set, next is the
+ * full (failure-resolved) transition table so each input byte costs
+ * one lookup regardless of the number of patterns. out is the first
+ * pattern that ends in a state (chained through out_next for duplicate
+ * patterns) and dict the closest state on the suffix chain that has
+ * an output.
+ */
+struct ptn_ac {
+	uint32_t (*next)[256];
+	int32_t* out;
+	int32_t* out_next;
+	uint32_t* dict;
+	size_t n_states;
+
+/* longest pattern, used for the overlap between parallel scans, and if
+ * FLAG_STATE is used anywhere (forces scanning to be sequential) */
+	size_t max_len;
+	bool stateful;
+};
+
 /* match order for enum rwstat_pack */
 static int pack_sizes[] = {
 	4,
@@ -35,6 +68,59 @@ static int pack_sizes[] = {
 	1
 };
 
+/*
+ * buf, alpha and the entropy LUT of a channel are carved out of one
+ * block that only ever grows (geometrically), so resizes and packing
+ * switches reuse memory that is already faulted in. Each part starts on
+ * a cache line and blocks beyond a huge page are hinted for THP.
+ */
+#define ARENA_ALIGN 64
+#define ARENA_HUGE (2 * 1024 * 1024)
+
+struct arena {
+	uint8_t* mem;
+	size_t cap;
+	size_t used;
+};
+
+/* pixel rectangle [x1, x2) x [y1, y2) */
+struct rw_region {
+	size_t x1, y1, x2, y2;
+};
+
+/*
+ * A frame built from a keyed borrowed block (see ch_cache_key), along
+ * with everything besides the bytes that decides what it looks like.
+ * Entries are kept most recently used first and the pattern summary of
+ * the frame is kept so that it can be repeated on a hit.
+ */
+struct fc_hit {
+	int evc;
+	size_t first;
+};
+
+struct fc_ent {
+	struct fc_ent* next;
+	uint64_t key;
+	size_t base;
+	enum rwstat_pack pack;
+	enum rwstat_mapping map;
+	enum rwstat_alpha amode;
+	size_t ent_win;
+	bool ent_slide;
+	uint32_t ptn_ver;
+	size_t sz;
+
+	shmif_pixel* px;
+	uint64_t* tuple_mask;
+	struct fc_hit* hits;
+	size_t n_hits;
+};
+
+struct rwstat_ch_priv;
+typedef void (*pack_kernel_fn)(struct rwstat_ch_priv*,
+	const uint8_t* src, size_t ofs, size_t npx);
+
 struct rwstat_ch_priv {
 	enum rwstat_clock clock;
 	enum rwstat_pack pack;
@@ -46,20 +132,89 @@ struct rwstat_ch_priv {
 /* scaling factors used for some mapping modes */
 	float sf_x, sf_y;
 	uint8_t pack_sz;
-	uint16_t* cmap;
 
-/* scales O(n) */
+/* shared through the LUT cache, never written to */
+	const uint16_t* cmap;
+
+/* selected from kernels[map][pack] whenever either changes */
+	pack_kernel_fn kernel;
+
+/* number of ranges the frame is split into when using the pool */
+	size_t n_tasks;
+
+/* compiled lazily on the next step after patterns have been added,
+ * ac_state / ac_av are carried between frames if ptn_persist is set */
 	struct pattern* patterns;
 	size_t n_patterns;
 	size_t patterns_sz;
+	struct ptn_ac ac;
+	bool ac_dirty;
+	bool ptn_persist;
+	uint32_t ac_state;
+	uint8_t ac_av;
+
+/* incremented whenever the pattern set changes */
+	uint32_t ptn_ver;
 
 /* statistics for the data connection as such */
 	size_t cnt_total;
 	size_t cnt_local;
 	size_t buf_ofs;
 
-/* histogram used for estimating entropy etc. */
+/* bytes the sensor reported as never reaching the channel */
+	uint64_t cnt_drop;
+
+/* cnt_drop as of the last "drop:" message */
+	uint64_t drop_sent;
+
+/* RW_CLK_TIMED, minimum ms between frames, when the last one was built,
+ * bytes ingested since then and the pattern scan state over all of them.
+ * hg_n is the number of bytes the histogram holds, see timed_hgram */
+	struct {
+		unsigned interval;
+		unsigned long long last;
+		uint64_t pending;
+		uint32_t ac_state;
+		size_t hg_n;
+	} tm;
+
+/* publish the byte histogram of each frame */
+	bool hgram_export;
+
+/* cache of built frames, used bytes are bounded by budget. key is what
+ * src holds when valid, next the key announced for the next borrow */
+	struct {
+		struct fc_ent* first;
+		size_t budget, used;
+		uint64_t key, next;
+		bool valid, pending;
+	} fc;
+
+/* per-stage time (ns) and throughput since the last telemetry report,
+ * the stage counters are added to from pool threads */
+	struct {
+		bool on;
+		unsigned long long last;
+		uint64_t bytes, frames, drop;
+		uint64_t ent, ptn, pack, wait;
+	} tel;
+
+/* histogram used for estimating entropy etc. in RW_CLK_SLIDE,
+ * this always matches the contents of buf */
 	uint32_t hgram[256];
+	uint8_t hgram_norm[256];
+
+/* entropy alpha window in pixels (0, one row) and if it is centered
+ * on every pixel rather than split into blocks */
+	size_t ent_win;
+	bool ent_slide;
+
+/* per-block entropy c*log2(c) lookup */
+	float* ent_lut;
+	size_t ent_lut_sz;
+
+/* backing store for buf, alpha and ent_lut */
+	struct arena arena;
 
 /* we need a local intermediary buffer that we flush in
  * order to support switching modes of packing etc. */
@@ -67,14 +222,193 @@ struct rwstat_ch_priv {
 	uint8_t* buf;
 	size_t buf_sz;
 
+/* what the frame is built from, buf or caller memory borrowed for a
+ * full block (see ch_borrow) */
+	uint8_t* src;
+
+/* in RW_CLK_SLIDE and _TIMED, buf is a ring where head is both the oldest byte
+ * (logical offset 0) and the next write position */
+	size_t head;
+
 /* alpha buffer matches base * base and is sampled
  * by the packing function based on the amode of the ch */
 	uint8_t* alpha;
 
+/* byte pairs that were plotted in the last MAP_TUPLE frame, only
+ * the corresponding pixels need to be cleared for the next one */
+	uint64_t tuple_mask[1024];
+
+/* when pipelined, frames are built into stage and a handoff thread
+ * copies + synchs, pending is set while stage holds a frame that has
+ * not been copied yet and busy while the handoff is in progress */
+	struct {
+		shmif_pixel* stage;
+		pthread_t thread;
+		pthread_mutex_t lock;
+		pthread_cond_t cond;
+		bool alive, pending, busy;
+	} pipe;
+
+/* bytes [b1, b2) that the producer hinted as the only ones changed for
+ * the next frame (set), full is raised by anything that changes how
+ * every pixel is computed and both are reset on each step */
+	struct {
+		bool set, full;
+		size_t b1, b2;
+	} dmg;
+
+/* region of the frame staged for the handoff thread */
+	struct rw_region pipe_reg;
+
+/* parent has been told that the dirty region is valid */
+	bool subregion;
+
+/* what the kernels write to, either the segment or pipe.stage */
+	shmif_pixel* out;
+	size_t out_pitch;
+
 /* output segment */
 	struct arcan_shmif_cont* cont;
+
+/* headless, cont is a plain memory buffer owned by the channel and the
+ * signal / events go to the sink */
+	struct rwstat_sink* sink;
+	struct rwstat_ch* self;
+};
+
+/*
+ * Optional process-wide worker pool, shared by all channels. Only one
+ * job runs at a time, a channel that finds the pool busy builds its
+ * frame on its own thread instead of waiting. The thread that submits
+ * a job also works on it, pool_run returns when all tasks are done.
+ */
+static struct {
+	pthread_mutex_t lock;
+	pthread_mutex_t busy;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+
+	pthread_t* threads;
+	size_t n_threads;
+	bool alive;
+
+	void (*fn)(void*, size_t);
+	void* tag;
+	size_t n_tasks, next, finished;
+	uint64_t gen;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.busy = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER
 };
 
+/* frames smaller than this are not worth distributing */
+static const size_t par_min_px = 256 * 256;
+
+static void* pool_worker(void* arg)
+{
+	uint64_t gen = 0;
+	pthread_mutex_lock(&pool.lock);
+
+	while (pool.alive){
+		if (gen == pool.gen){
+			pthread_cond_wait(&pool.wake, &pool.lock);
+			continue;
+		}
+
+		gen = pool.gen;
+		while (pool.next < pool.n_tasks){
+			size_t ind = pool.next++;
+			void (*fn)(void*, size_t) = pool.fn;
+			void* tag = pool.tag;
+			pthread_mutex_unlock(&pool.lock);
+
+			fn(tag, ind);
+
+			pthread_mutex_lock(&pool.lock);
+			if (++pool.finished == pool.n_tasks)
+				pthread_cond_signal(&pool.done);
+		}
+	}
+
+	pthread_mutex_unlock(&pool.lock);
+	return NULL;
+}
+
+/*
+ * run fn(tag, [0..n_tasks-1]), returns false if there is no pool or
+ * it is already in use, and the caller should do the work itself.
+ */
+static bool pool_run(void (*fn)(void*, size_t), void* tag, size_t n_tasks)
+{
+	if (0 == pool.n_threads || 0 != pthread_mutex_trylock(&pool.busy))
+		return false;
+
+	pthread_mutex_lock(&pool.lock);
+	pool.fn = fn;
+	pool.tag = tag;
+	pool.n_tasks = n_tasks;
+	pool.next = 0;
+	pool.finished = 0;
+	pool.gen++;
+	pthread_cond_broadcast(&pool.wake);
+
+	while (pool.next < pool.n_tasks){
+		size_t ind = pool.next++;
+		pthread_mutex_unlock(&pool.lock);
+		fn(tag, ind);
+		pthread_mutex_lock(&pool.lock);
+		pool.finished++;
+	}
+
+	while (pool.finished < pool.n_tasks)
+		pthread_cond_wait(&pool.done, &pool.lock);
+
+	pthread_mutex_unlock(&pool.lock);
+	pthread_mutex_unlock(&pool.busy);
+	return true;
+}
+
+bool rwstat_workers(size_t n)
+{
+	pthread_mutex_lock(&pool.busy);
+
+	if (pool.n_threads){
+		pthread_mutex_lock(&pool.lock);
+		pool.alive = false;
+		pthread_cond_broadcast(&pool.wake);
+		pthread_mutex_unlock(&pool.lock);
+
+		for (size_t i = 0; i < pool.n_threads; i++)
+			pthread_join(pool.threads[i], NULL);
+
+		free(pool.threads);
+		pool.threads = NULL;
+		pool.n_threads = 0;
+	}
+
+	if (0 == n){
+		pthread_mutex_unlock(&pool.busy);
+		return true;
+	}
+
+	pool.threads = malloc(sizeof(pthread_t) * n);
+	if (!pool.threads){
+		pthread_mutex_unlock(&pool.busy);
+		return false;
+	}
+
+	pool.alive = true;
+	for (; pool.n_threads < n; pool.n_threads++)
+		if (0 != pthread_create(&pool.threads[pool.n_threads],
+			NULL, pool_worker, NULL))
+			break;
+
+	pthread_mutex_unlock(&pool.busy);
+	return pool.n_threads > 0;
+}
+
 /*
  * hilbert curve functions
  * [plucked straight from wikipedia]
@@ -110,168 +444,1473 @@ static void hilbert_d2xy(int n, int d, int* x, int* y)
 	}
 }
 
-static inline void rebuild_hgram(struct rwstat_ch_priv* chp)
+/*
+ * morton / z-order, even bits of the offset are x and odd bits y, so
+ * it can be resolved directly rather than through a LUT
+ */
+static inline uint32_t morton_compact(uint32_t v)
 {
-	for (size_t i = 0; i < chp->buf_sz; i++)
-		chp->hgram[ chp->buf[ i ] ]++;
+#if defined(__BMI2__)
+	return _pext_u32(v, 0x55555555);
+#else
+	v &= 0x55555555;
+	v = (v | (v >> 1)) & 0x33333333;
+	v = (v | (v >> 2)) & 0x0f0f0f0f;
+	v = (v | (v >> 4)) & 0x00ff00ff;
+	v = (v | (v >> 8)) & 0x0000ffff;
+	return v;
+#endif
 }
 
 /*
- * calculate shannon entropy with a previously supplied histogram
+ * The coordinate LUTs only depend on mapping and base, so all channels
+ * share them through a refcounted cache. The last table to be released
+ * is kept around so that switching back and forth between mappings, or
+ * a resize to the same base, doesn't pay for building it again.
  */
-static inline float shent_h(uint8_t* buf, size_t bufsz, uint32_t hgram[256])
+struct lut_ent {
+	enum rwstat_mapping map;
+	size_t base;
+	size_t refs;
+	uint16_t* lut;
+	struct lut_ent* next;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct lut_ent* first;
+} luts = {
+	.lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static uint16_t* lut_build(enum rwstat_mapping map, size_t base)
+{
+	size_t hsz = base * base;
+	uint16_t* lut = malloc(2 * 2 * hsz);
+	if (!lut)
+		return NULL;
+
+	if (map == MAP_HILBERT)
+		for (size_t i = 0; i < hsz; i++){
+			int x, y;
+			hilbert_d2xy(base, i, &x, &y);
+			lut[i * 2 + 0] = x;
+			lut[i * 2 + 1] = y;
+		}
+
+	return lut;
+}
+
+/* returns NULL if the mapping doesn't use a LUT or on allocation failure */
+static const uint16_t* lut_get(enum rwstat_mapping map, size_t base)
+{
+	if (map != MAP_HILBERT)
+		return NULL;
+
+	pthread_mutex_lock(&luts.lock);
+	struct lut_ent* ent = luts.first;
+	while (ent && (ent->map != map || ent->base != base))
+		ent = ent->next;
+
+/* built with the lock held, anyone else asking would want the same one */
+	if (!ent){
+		ent = malloc(sizeof(struct lut_ent));
+		uint16_t* lut = ent ? lut_build(map, base) : NULL;
+		if (!lut){
+			free(ent);
+			pthread_mutex_unlock(&luts.lock);
+			return NULL;
+		}
+
+		*ent = (struct lut_ent){
+			.map = map,
+			.base = base,
+			.lut = lut,
+			.next = luts.first
+		};
+		luts.first = ent;
+	}
+
+	ent->refs++;
+	pthread_mutex_unlock(&luts.lock);
+	return ent->lut;
+}
+
+static void lut_put(const uint16_t* lut)
 {
-	float ent = 0.0f;
-	for (size_t i = 0; i < bufsz; i++){
-		float pr = (float)hgram[buf[i]] / (float) bufsz;
-		ent -= pr * log2f(pr);
+	if (!lut)
+		return;
+
+	pthread_mutex_lock(&luts.lock);
+	struct lut_ent** cur = &luts.first;
+	struct lut_ent* keep = NULL;
+
+	while (*cur){
+		struct lut_ent* ent = *cur;
+		if (ent->lut == lut && --ent->refs == 0)
+			keep = ent;
+
+/* only the one just released stays cached */
+		if (ent->refs == 0 && ent != keep){
+			*cur = ent->next;
+			free(ent->lut);
+			free(ent);
+			continue;
+		}
+		cur = &ent->next;
 	}
 
-	return ent;
+	pthread_mutex_unlock(&luts.lock);
 }
 
 /*
- * calculate shannon entropy without a previous histogram
+ * larger spans are counted into four tables that are merged at the end,
+ * runs of the same byte would otherwise serialize on one counter
  */
-static inline float shent(uint8_t* buf, size_t bufsz)
+static void hgram_add(uint32_t* hgram, const uint8_t* buf, size_t n)
 {
-	uint32_t hgram[256] = {0};
-	for (size_t i = 0; i < bufsz; i++)
+	size_t i = 0;
+
+	if (n >= 4096){
+		uint32_t t[4][256];
+		memset(t, '\0', sizeof(t));
+
+		for (; i + 8 <= n; i += 8){
+			uint64_t v;
+			memcpy(&v, &buf[i], 8);
+			t[0][ v        & 0xff]++;
+			t[1][(v >>  8) & 0xff]++;
+			t[2][(v >> 16) & 0xff]++;
+			t[3][(v >> 24) & 0xff]++;
+			t[0][(v >> 32) & 0xff]++;
+			t[1][(v >> 40) & 0xff]++;
+			t[2][(v >> 48) & 0xff]++;
+			t[3][ v >> 56        ]++;
+		}
+
+		for (size_t j = 0; j < 256; j++)
+			hgram[j] += t[0][j] + t[1][j] + t[2][j] + t[3][j];
+	}
+
+	for (; i < n; i++)
 		hgram[ buf[i] ]++;
+}
+
+static inline void rebuild_hgram(struct rwstat_ch_priv* chp)
+{
+	memset(chp->hgram, '\0', sizeof(chp->hgram));
+	hgram_add(chp->hgram, chp->buf, chp->buf_sz);
+}
+
+/*
+ * resolve a logical offset in buf (taking the ring head into account)
+ * for a span of len bytes, *n1 is set to the number of bytes that are
+ * contiguous at the returned position, the rest continues at buf[0].
+ */
+static inline uint8_t* ring_ptr(
+	struct rwstat_ch_priv* chp, size_t lofs, size_t len, size_t* n1)
+{
+	size_t pos = chp->head + lofs;
+	if (pos >= chp->buf_sz)
+		pos -= chp->buf_sz;
+
+	*n1 = pos + len > chp->buf_sz ? chp->buf_sz - pos : len;
+	return &chp->src[pos];
+}
+
+static void reverse_bytes(uint8_t* buf, size_t n)
+{
+	for (size_t i = 0, j = n; i < j--; i++){
+		uint8_t t = buf[i];
+		buf[i] = buf[j];
+		buf[j] = t;
+	}
+}
+
+/*
+ * rotate the ring so that the logical start is at buf[0] again
+ */
+static void ring_linearize(struct rwstat_ch_priv* chp)
+{
+	if (0 == chp->head)
+		return;
+
+	reverse_bytes(chp->buf, chp->head);
+	reverse_bytes(chp->buf + chp->head, chp->buf_sz - chp->head);
+	reverse_bytes(chp->buf, chp->buf_sz);
+	chp->head = 0;
+}
+
+static size_t arena_align(size_t n)
+{
+	return (n + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+}
+
+/*
+ * make room for sz bytes and start over from the beginning of the block,
+ * the contents are not preserved when it has to grow. On failure the
+ * old block is left intact.
+ */
+static bool arena_reset(struct arena* a, size_t sz)
+{
+	a->used = 0;
+	if (sz <= a->cap)
+		return true;
+
+	size_t cap = a->cap * 2 > sz ? a->cap * 2 : sz;
+	size_t gran = cap >= ARENA_HUGE ? ARENA_HUGE : (size_t) sysconf(_SC_PAGESIZE);
+	cap = (cap + gran - 1) / gran * gran;
+
+	void* mem = mmap(NULL, cap, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == mem)
+		return false;
+
+#ifdef MADV_HUGEPAGE
+	if (cap >= ARENA_HUGE)
+		madvise(mem, cap, MADV_HUGEPAGE);
+#endif
+
+	if (a->mem)
+		munmap(a->mem, a->cap);
+	a->mem = mem;
+	a->cap = cap;
+	return true;
+}
+
+static void* arena_take(struct arena* a, size_t sz)
+{
+	void* res = a->mem + a->used;
+	a->used += arena_align(sz);
+	return res;
+}
+
+static void arena_free(struct arena* a)
+{
+	if (a->mem)
+		munmap(a->mem, a->cap);
+	*a = (struct arena){0};
+}
+
+/*
+ * c * log2(c) for all the counts that can occur within one entropy
+ * block, rebuilt whenever the block size (base * pack_sz) changes.
+ */
+static void build_entlut(struct rwstat_ch_priv* chp, float* lut, size_t nb)
+{
+	chp->ent_lut = lut;
+	chp->ent_lut_sz = nb + 1;
+
+	lut[0] = 0.0f;
+	for (size_t i = 1; i <= nb; i++)
+		lut[i] = (float) i * log2f((float) i);
+}
 
-	return shent_h(buf, bufsz, hgram);
+static inline float clog2c(struct rwstat_ch_priv* chp, uint32_t c)
+{
+	if (c < chp->ent_lut_sz)
+		return chp->ent_lut[c];
+
+	return (float) c * log2f((float) c);
+}
+
+/*
+ * calculate shannon entropy from the bins of a histogram, using
+ * H = log2(n) - 1/n * sum( c * log2(c) ), so the cost is O(256)
+ * regardless of how many bytes the histogram covers.
+ */
+static inline float shent_h(struct rwstat_ch_priv* chp, const uint32_t* hgram)
+{
+	size_t n = 0;
+	float acc = 0.0f;
+
+	for (size_t i = 0; i < 256; i++){
+		n += hgram[i];
+		acc += clog2c(chp, hgram[i]);
+	}
+
+	if (0 == n)
+		return 0.0f;
+
+	return log2f((float) n) - acc / (float) n;
 }
 
 /*
- * normalize histogram to 0..255 range
+ * normalize histogram to 0..255 range, kept separate from the
+ * counts as those need to remain intact for sliding updates
  */
-static inline void hnorm(uint32_t* hgram)
+static inline void hnorm(const uint32_t* hgram, uint8_t* out)
 {
-	uint32_t acc = 0;
+	uint64_t acc = 0;
 	for (int i = 0; i < 256; i++)
 		acc += hgram[ i ];
 
 	if (acc > 0){
 		for (int i = 0; i < 256; i++)
-			hgram[i] = (uint8_t) (255 * ((float)hgram[i] / (float) acc));
+			out[i] = (uint8_t) (255 * ((float)hgram[i] / (float) acc));
+	}
+	else
+		memset(out, '\0', 256);
+}
+
+/*
+ * Mapping stages for the packing kernels, each packs npx pixels starting
+ * at pixel offset ofs from contiguous source bytes. These are expanded
+ * for every packing row function below so that each (mapping, packing)
+ * pair gets its own specialized kernel.
+ */
+static inline void map_wrap(struct rwstat_ch_priv* chp,
+	const uint8_t* src, size_t ofs, size_t npx, pack_row_fn row)
+{
+	shmif_pixel* vidp = chp->out;
+	size_t pitch = chp->out_pitch;
+
+	while (npx){
+		size_t x = ofs % chp->base;
+		size_t y = ofs / chp->base;
+		size_t n = chp->base - x;
+		n = n > npx ? npx : n;
+
+		row(&vidp[pitch * y + x], src, &chp->alpha[ofs], chp->hgram_norm, n);
+		src += n * chp->pack_sz;
+		ofs += n;
+		npx -= n;
 	}
 }
 
-static inline void pack_bytes(
-	struct rwstat_ch_priv* chp, uint8_t* buf, size_t ofs)
+static inline void map_hilbert(struct rwstat_ch_priv* chp,
+	const uint8_t* src, size_t ofs, size_t npx, pack_row_fn row)
 {
-	int x = 0, y = 0;
-	shmif_pixel val = 0;
-	int lofs = 0;
+	shmif_pixel* vidp = chp->out;
+	size_t pitch = chp->out_pitch;
+	shmif_pixel tmp[256];
+
+/* pack contiguous, then scatter through the LUT */
+	while (npx){
+		size_t n = npx > 256 ? 256 : npx;
+		row(tmp, src, &chp->alpha[ofs], chp->hgram_norm, n);
+
+		const uint16_t* cmap = &chp->cmap[ofs * 2];
+		for (size_t i = 0; i < n; i++)
+			vidp[pitch * cmap[i * 2 + 1] + cmap[i * 2]] = tmp[i];
+
+		src += n * chp->pack_sz;
+		ofs += n;
+		npx -= n;
+	}
+}
 
-	switch (chp->map){
-	case MAP_WRAP:
-		x = ofs % chp->base;
-		y = ofs / chp->base;
-	break;
+static inline void map_morton(struct rwstat_ch_priv* chp,
+	const uint8_t* src, size_t ofs, size_t npx, pack_row_fn row)
+{
+	shmif_pixel* vidp = chp->out;
+	size_t pitch = chp->out_pitch;
+	shmif_pixel tmp[256];
 
-	case MAP_TUPLE:
-		lofs += 2;
-		x = (float)buf[0] * chp->sf_x;
-		y = (float)buf[1] * chp->sf_y;
-	break;
+	while (npx){
+		size_t n = npx > 256 ? 256 : npx;
+		row(tmp, src, &chp->alpha[ofs], chp->hgram_norm, n);
 
-	case MAP_HILBERT:
-		x = chp->cmap[ofs * 2 + 0];
-		y = chp->cmap[ofs * 2 + 1];
-	break;
+		for (size_t i = 0; i < n; i++){
+			uint32_t d = ofs + i;
+			vidp[pitch * morton_compact(d >> 1) + morton_compact(d)] = tmp[i];
+		}
+
+		src += n * chp->pack_sz;
+		ofs += n;
+		npx -= n;
 	}
+}
 
-	switch (chp->pack){
-	case PACK_TIGHT:
-		val = RGBA(buf[lofs+0], buf[lofs+1], buf[lofs+2], buf[lofs+3]);
-	break;
-	case PACK_TNOALPHA:
-		val = RGBA(buf[lofs+0], buf[lofs+1], buf[lofs+2], chp->alpha[ofs]);
-	break;
-	case PACK_INTENS:
-		val = RGBA(buf[lofs], buf[lofs], buf[lofs], chp->alpha[ofs]);
-	break;
-	case PACK_HINTENS:
-	{
-		uint8_t hv = chp->hgram[buf[lofs]];
-		val = RGBA(hv, hv, hv, chp->alpha[ofs]);
+static inline void map_tuple(struct rwstat_ch_priv* chp,
+	const uint8_t* src, size_t ofs, size_t npx, pack_row_fn row)
+{
+	shmif_pixel* vidp = chp->out;
+	size_t pitch = chp->out_pitch;
+
+	for (size_t i = 0; i < npx; i++, src += chp->pack_sz){
+		size_t x = (float)src[0] * chp->sf_x;
+		size_t y = (float)src[1] * chp->sf_y;
+		size_t v = src[0] << 8 | src[1];
+		chp->tuple_mask[v >> 6] |= 1ull << (v & 63);
+		row(&vidp[pitch * y + x], &src[2], &chp->alpha[ofs + i],
+			chp->hgram_norm, 1);
 	}
-	break;
+}
+
+#define PACK_KERNEL(MAP, PACK)\
+static void kernel_##MAP##_##PACK(struct rwstat_ch_priv* chp,\
+	const uint8_t* src, size_t ofs, size_t npx)\
+{\
+	map_##MAP(chp, src, ofs, npx, pack_##PACK);\
+}
+
+PACK_KERNEL(wrap, tight)
+PACK_KERNEL(wrap, tnoalpha)
+PACK_KERNEL(wrap, intens)
+PACK_KERNEL(wrap, hintens)
+PACK_KERNEL(tuple, tight)
+PACK_KERNEL(tuple, tnoalpha)
+PACK_KERNEL(tuple, intens)
+PACK_KERNEL(tuple, hintens)
+PACK_KERNEL(hilbert, tight)
+PACK_KERNEL(hilbert, tnoalpha)
+PACK_KERNEL(hilbert, intens)
+PACK_KERNEL(hilbert, hintens)
+PACK_KERNEL(morton, tight)
+PACK_KERNEL(morton, tnoalpha)
+PACK_KERNEL(morton, intens)
+PACK_KERNEL(morton, hintens)
+
+/* match order for enum rwstat_mapping, enum rwstat_pack */
+static pack_kernel_fn kernels[][4] = {
+	{
+		kernel_wrap_tight, kernel_wrap_tnoalpha,
+		kernel_wrap_intens, kernel_wrap_hintens
+	},
+	{
+		kernel_tuple_tight, kernel_tuple_tnoalpha,
+		kernel_tuple_intens, kernel_tuple_hintens
+	},
+	{
+		kernel_hilbert_tight, kernel_hilbert_tnoalpha,
+		kernel_hilbert_intens, kernel_hilbert_hintens
+	},
+	{
+		kernel_morton_tight, kernel_morton_tnoalpha,
+		kernel_morton_intens, kernel_morton_hintens
 	}
+};
+
+/*
+ * window size for entropy alpha in pixels, clamped to a row which is
+ * also the most that the c * log2(c) LUT covers. Blocks are rounded
+ * down to a power of two so that they never straddle the (power of two)
+ * ranges that the frame is split into between pool tasks.
+ */
+static inline size_t ent_window(struct rwstat_ch_priv* chp)
+{
+	size_t win = chp->ent_win && chp->ent_win < chp->base ?
+		chp->ent_win : chp->base;
+
+	if (!chp->ent_slide)
+		while (win & (win - 1))
+			win &= win - 1;
+
+	return win;
+}
+
+/*
+ * Sliding windows keep S = sum(c * log2(c)) of the histogram up to date
+ * as bytes are added and removed, so that the entropy is available in
+ * O(1) per byte instead of a pass over all 256 bins per window.
+ */
+static inline void ent_add(struct rwstat_ch_priv* chp,
+	uint32_t* hgram, double* s, uint8_t v)
+{
+	uint32_t c = hgram[v]++;
+	*s += clog2c(chp, c + 1) - clog2c(chp, c);
+}
+
+static inline void ent_sub(struct rwstat_ch_priv* chp,
+	uint32_t* hgram, double* s, uint8_t v)
+{
+	uint32_t c = hgram[v]--;
+	*s += clog2c(chp, c - 1) - clog2c(chp, c);
+}
+
+/* H = (n * log2(n) - S) / n, clamped against accumulated rounding */
+static inline uint8_t ent_alpha(struct rwstat_ch_priv* chp, double s, size_t n)
+{
+	if (0 == n)
+		return 0;
+
+	double h = (clog2c(chp, n) - s) / (double) n;
+	h = h < 0.0 ? 0.0 : (h > 8.0 ? 8.0 : h);
+	return (uint8_t) (255.0f * ((float) h / 8.0f));
+}
 
-	chp->cont->vidp[ chp->cont->addr->w * y + x ] = val;
+static inline uint8_t src_byte(struct rwstat_ch_priv* chp, size_t lofs)
+{
+	size_t pos = chp->head + lofs;
+	return chp->src[pos >= chp->buf_sz ? pos - chp->buf_sz : pos];
 }
 
 /*
- * build alphamap with shannon entropy based on a specific blocksize,
- * bsz should always be % chp->buf_sz otherwise
+ * every pixel gets the entropy of the window centered on it (clipped
+ * at the frame edges), moving one pixel along adds and removes pack_sz
+ * bytes from the running histogram
  */
-static void update_entalpha(struct rwstat_ch_priv* chp, size_t bsz)
+static void slide_entalpha(
+	struct rwstat_ch_priv* chp, size_t win, size_t p1, size_t p2)
 {
-	size_t bsqr = chp->base * chp->base;
+	size_t npx = chp->buf_sz / chp->pack_sz;
+	size_t psz = chp->pack_sz;
+	size_t h = win / 2;
+	uint32_t hgram[256] = {0};
+	double s = 0.0;
+
+	size_t lo = p1 > h ? p1 - h : 0;
+	size_t hi = lo;
 
-	for (size_t i = 0; i < bsqr; i += bsz){
-		uint8_t entalpha = (uint8_t) (255.0f *
-			(shent(&chp->buf[i*chp->pack_sz], bsz * chp->pack_sz) / 8.0f));
+	for (size_t i = p1; i < p2; i++){
+		size_t lo_t = i > h ? i - h : 0;
+		size_t hi_t = i + win - h > npx ? npx : i + win - h;
 
-		memset(&chp->alpha[i], entalpha, bsz);
+		for (; hi < hi_t; hi++)
+			for (size_t j = 0; j < psz; j++)
+				ent_add(chp, hgram, &s, src_byte(chp, hi * psz + j));
+
+		for (; lo < lo_t; lo++)
+			for (size_t j = 0; j < psz; j++)
+				ent_sub(chp, hgram, &s, src_byte(chp, lo * psz + j));
+
+		chp->alpha[i] = ent_alpha(chp, s, (hi - lo) * psz);
 	}
 }
 
 /*
- * Use the current set of patterns to populate the alpha buffer
- * that is then sampled when building the final output.
+ * build alphamap with shannon entropy per window- sized block, for the
+ * blocks that start within [p1, p2) (pixel offsets). Large blocks are
+ * evaluated over the full histogram, small ones only over the bins that
+ * their bytes touched so that the cost doesn't grow with 256 / nb.
  */
-static void update_ptnalpha(struct rwstat_ch_priv* chp)
+static void update_entalpha(struct rwstat_ch_priv* chp, size_t p1, size_t p2)
 {
-	uint8_t av = 0xff;
-	if (chp->n_patterns == 0){
-		memset(chp->alpha, av, chp->base * chp->base);
+	size_t win = ent_window(chp);
+	if (chp->ent_slide){
+		slide_entalpha(chp, win, p1, p2);
 		return;
 	}
 
-/* reset patterns */
+	size_t npx = chp->buf_sz / chp->pack_sz;
+	uint32_t hgram[256] = {0};
+
+	for (size_t i = p1 - p1 % win; i < p2; i += win){
+		size_t n = i + win > npx ? npx - i : win;
+		size_t nb = n * chp->pack_sz;
+		size_t n1;
+		uint8_t* blk = ring_ptr(chp, i * chp->pack_sz, nb, &n1);
+		uint8_t entalpha;
+
+		if (nb >= 256){
+			hgram_add(hgram, blk, n1);
+			hgram_add(hgram, chp->src, nb - n1);
+			entalpha = (uint8_t) (255.0f * (shent_h(chp, hgram) / 8.0f));
+			memset(hgram, '\0', sizeof(hgram));
+		}
+		else {
+			for (size_t j = 0; j < n1; j++)
+				hgram[blk[j]]++;
+			for (size_t j = 0; j < nb - n1; j++)
+				hgram[chp->src[j]]++;
+
+/* only the bins that were touched contribute, and need to be reset */
+			double s = 0.0;
+			for (size_t j = 0; j < nb; j++){
+				uint8_t v = j < n1 ? blk[j] : chp->src[j - n1];
+				s += clog2c(chp, hgram[v]);
+				hgram[v] = 0;
+			}
+			entalpha = ent_alpha(chp, s, nb);
+		}
+
+		memset(&chp->alpha[i], entalpha, n);
+	}
+}
+
+static void ac_free(struct ptn_ac* ac)
+{
+	free(ac->next);
+	free(ac->out);
+	free(ac->out_next);
+	free(ac->dict);
+	memset(ac, '\0', sizeof(struct ptn_ac));
+}
+
+/*
+ * build trie from the pattern set, then resolve failure links in
+ * breadth-first order into the transition table. Row 0 (root) uses
+ * 0 both for 'no child' and 'back to root', which is valid as the
+ * root can never be the child of another state.
+ */
+static bool ac_build(struct rwstat_ch_priv* chp)
+{
+	struct ptn_ac* ac = &chp->ac;
+	ac_free(ac);
+
+	size_t lim = 1;
+	for (size_t i = 0; i < chp->n_patterns; i++)
+		lim += chp->patterns[i].buf_sz;
+
+	ac->next = calloc(lim, sizeof(uint32_t[256]));
+	ac->out = malloc(lim * sizeof(int32_t));
+	ac->dict = calloc(lim, sizeof(uint32_t));
+	ac->out_next = malloc(chp->n_patterns * sizeof(int32_t));
+	uint32_t* fail = calloc(lim, sizeof(uint32_t));
+	uint32_t* queue = malloc(lim * sizeof(uint32_t));
+
+	if (!ac->next || !ac->out || !ac->dict || !ac->out_next || !fail || !queue){
+		free(fail);
+		free(queue);
+		ac_free(ac);
+		return false;
+	}
+
+	for (size_t i = 0; i < lim; i++)
+		ac->out[i] = -1;
+	ac->n_states = 1;
+
 	for (size_t i = 0; i < chp->n_patterns; i++){
-		chp->patterns[i].buf_pos = 0;
-		chp->patterns[i].evc = 0;
+		struct pattern* ptn = &chp->patterns[i];
+		uint32_t st = 0;
+		if (0 == ptn->buf_sz)
+			continue;
+
+		for (size_t j = 0; j < ptn->buf_sz; j++){
+			uint32_t* nx = &ac->next[st][ptn->buf[j]];
+			if (0 == *nx)
+				*nx = ac->n_states++;
+			st = *nx;
+		}
+
+		ac->out_next[i] = ac->out[st];
+		ac->out[st] = i;
+
+		if (ptn->buf_sz > ac->max_len)
+			ac->max_len = ptn->buf_sz;
+		if ((ptn->flags & FLAG_STATE))
+			ac->stateful = true;
 	}
 
-/* If ptn-match ever becomes a performance choke,
- * here is a good spot for adding parallelization. */
-	for (size_t i = 0; i < chp->buf_sz; i++){
-		chp->alpha[i] = av;
+	size_t qh = 0, qt = 0;
+	for (size_t b = 0; b < 256; b++)
+		if (ac->next[0][b])
+			queue[qt++] = ac->next[0][b];
 
-		for (size_t j = 0; j < chp->n_patterns; j++){
-			struct pattern* ptn = &chp->patterns[j];
-			if (ptn->buf[ptn->buf_pos] == chp->buf[i])
-			 	if (++(ptn->buf_pos) == ptn->buf_sz){
-					chp->patterns[j].buf_pos = 0;
-					memset(&chp->alpha[i - ptn->buf_sz], ptn->alpha, ptn->buf_sz);
-					if ((ptn->flags & FLAG_STATE))
-						av = ptn->alpha;
-					if ((ptn->flags & FLAG_EVENT))
-						ptn->evc++;
-				}
+	while (qh < qt){
+		uint32_t st = queue[qh++];
+
+		for (size_t b = 0; b < 256; b++){
+			uint32_t u = ac->next[st][b];
+			uint32_t fv = ac->next[ fail[st] ][b];
+
+			if (0 == u){
+				ac->next[st][b] = fv;
+				continue;
 			}
 
+			fail[u] = fv;
+			ac->dict[u] = ac->out[fv] >= 0 ? fv : ac->dict[fv];
+			queue[qt++] = u;
+		}
 	}
 
-
-/* Check matched patterns and fire an event with the matching
- * identifier, and the number of times each event was matched
- * in the buffer window. Abuse the CURSORINPUT event for this */
+	free(fail);
+	free(queue);
+	chp->ac_state = 0;
+	chp->tm.ac_state = 0;
+	return true;
+}
+
+/*
+ * mark the pixels covered by a match that ended at byte ofs, clamped to
+ * the bytes [b1, b2) that the caller is responsible for. av is NULL for
+ * matches that are only found in the look-ahead of a parallel scan.
+ */
+static inline void ptn_hit(struct rwstat_ch_priv* chp,
+	struct pattern* ptn, size_t ofs, size_t b1, size_t b2, uint8_t* av)
+{
+	size_t first = ofs + 1 >= ptn->buf_sz ? ofs + 1 - ptn->buf_sz : 0;
+	size_t last = ofs;
+	first = first < b1 ? b1 : first;
+	last = last >= b2 ? b2 - 1 : last;
+	if (first > last)
+		return;
+
+	size_t p1 = first / chp->pack_sz;
+	size_t p2 = last / chp->pack_sz;
+	memset(&chp->alpha[p1], ptn->alpha, p2 - p1 + 1);
+
+	if (!av)
+		return;
+
+	if ((ptn->flags & FLAG_STATE))
+		*av = ptn->alpha;
+	if (!(ptn->flags & FLAG_EVENT))
+		return;
+
+	__sync_fetch_and_add(&ptn->evc, 1);
+	size_t start = ofs + 1 >= ptn->buf_sz ? ofs + 1 - ptn->buf_sz : 0;
+	size_t cur = __atomic_load_n(&ptn->first, __ATOMIC_RELAXED);
+	while (start < cur && !__atomic_compare_exchange_n(&ptn->first,
+		&cur, start, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+static inline uint32_t ptn_scan(struct rwstat_ch_priv* chp, uint32_t st,
+	size_t ofs, size_t end, size_t b1, size_t b2, uint8_t* av)
+{
+	struct ptn_ac* ac = &chp->ac;
+	size_t n1;
+	uint8_t* src = ring_ptr(chp, ofs, end - ofs, &n1);
+
+	for (; ofs < end; ofs++){
+		st = ac->next[st][ *src ];
+		if (0 == --n1)
+			src = chp->src;
+		else
+			src++;
+
+		uint32_t m = ac->out[st] >= 0 ? st : ac->dict[st];
+		while (m){
+			for (int32_t k = ac->out[m]; k >= 0; k = ac->out_next[k])
+				ptn_hit(chp, &chp->patterns[k], ofs, b1, b2, av);
+			m = ac->dict[m];
+		}
+	}
+
+	return st;
+}
+
+/*
+ * Use the current set of patterns to populate the alpha buffer for the
+ * pixels [p1, p2). Scanning is a single pass through the compiled
+ * automaton. When the frame is split (par), the scan is warmed up with
+ * the max_len - 1 bytes before the range and continues max_len - 1
+ * bytes past it, so that matches which cross range boundaries are
+ * found, but only those that end within the range are counted.
+ */
+static void update_ptnalpha(
+	struct rwstat_ch_priv* chp, size_t p1, size_t p2, bool par)
+{
+	struct ptn_ac* ac = &chp->ac;
+	uint8_t av = 0xff;
+
+	if (chp->n_patterns == 0 || !ac->next){
+		memset(&chp->alpha[p1], av, p2 - p1);
+		return;
+	}
+
+	size_t b1 = p1 * chp->pack_sz;
+	size_t b2 = p2 * chp->pack_sz;
+	size_t ovl = ac->max_len - 1;
+	uint32_t st = 0;
+
+	if (0 == p1 && chp->ptn_persist){
+		st = chp->ac_state;
+		av = chp->ac_av;
+	}
+	else if (par && p1 > 0){
+		size_t warm = b1 > ovl ? b1 - ovl : 0;
+		st = ptn_scan(chp, 0, warm, b1, b1, b1, NULL);
+	}
+
+	for (size_t i = p1; i < p2; i++){
+		chp->alpha[i] = av;
+		size_t ofs = i * chp->pack_sz;
+		st = ptn_scan(chp, st, ofs, ofs + chp->pack_sz, b1, b2, &av);
+	}
+
+	if (p2 * chp->pack_sz == chp->buf_sz){
+		chp->ac_state = st;
+		chp->ac_av = av;
+	}
+	else if (par){
+		size_t end = b2 + ovl > chp->buf_sz ? chp->buf_sz : b2 + ovl;
+		ptn_scan(chp, st, b2, end, b1, b2, NULL);
+	}
+}
+
+/*
+ * pack the pixels [p1, p2), reading through the ring as (at most) two
+ * contiguous spans, a pixel that straddles the end of the ring is
+ * copied out and packed on its own
+ */
+static void pack_range(struct rwstat_ch_priv* chp, size_t p1, size_t p2)
+{
+	size_t nb = (p2 - p1) * chp->pack_sz;
+	size_t n1;
+	uint8_t* src = ring_ptr(chp, p1 * chp->pack_sz, nb, &n1);
+	size_t npx = n1 / chp->pack_sz;
+	size_t rem = n1 - npx * chp->pack_sz;
+	size_t ofs = p1 + npx;
+	chp->kernel(chp, src, p1, npx);
+
+	if (ofs == p2)
+		return;
+
+	src = chp->src;
+	if (rem){
+		uint8_t tmp[8];
+		memcpy(tmp, &chp->src[chp->buf_sz - rem], rem);
+		memcpy(tmp + rem, chp->src, chp->pack_sz - rem);
+		chp->kernel(chp, tmp, ofs++, 1);
+		src += chp->pack_sz - rem;
+	}
+
+	if (ofs < p2)
+		chp->kernel(chp, src, ofs, p2 - ofs);
+}
+
+static uint64_t tel_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* add the time since *ts to dst and restart *ts, no-op unless enabled */
+static void tel_add(struct rwstat_ch_priv* chp, uint64_t* dst, uint64_t* ts)
+{
+	if (!chp->tel.on)
+		return;
+
+	uint64_t now = tel_ns();
+	__atomic_fetch_add(dst, now - *ts, __ATOMIC_RELAXED);
+	*ts = now;
+}
+
+/*
+ * all the stages of building a frame that can run independently for
+ * a range of pixels, used both as a pool task and for the serial path,
+ * with parallel tasks the stage times are the sum over all workers
+ */
+static void build_range(
+	struct rwstat_ch_priv* chp, size_t p1, size_t p2, bool par)
+{
+	uint64_t ts = chp->tel.on ? tel_ns() : 0;
+
+	if (chp->amode == RW_ALPHA_ENTBASE){
+		update_entalpha(chp, p1, p2);
+		tel_add(chp, &chp->tel.ent, &ts);
+	}
+	else if (chp->amode == RW_ALPHA_PTN){
+		update_ptnalpha(chp, p1, p2, par);
+		tel_add(chp, &chp->tel.ptn, &ts);
+	}
+
+/* tuple writes scatter on data values so ranges would collide */
+	if (chp->map != MAP_TUPLE){
+		pack_range(chp, p1, p2);
+		tel_add(chp, &chp->tel.pack, &ts);
+	}
+}
+
+static void tuple_range(struct rwstat_ch_priv* chp, size_t npx)
+{
+	uint64_t ts = chp->tel.on ? tel_ns() : 0;
+	pack_range(chp, 0, npx);
+	tel_add(chp, &chp->tel.pack, &ts);
+}
+
+/*
+ * tasks are power-of-two sized, row (=entropy block) aligned ranges,
+ * for the hilbert mapping that means compact sub-curves of the output
+ */
+static void build_task(void* tag, size_t ind)
+{
+	struct rwstat_ch_priv* chp = tag;
+	size_t npx = chp->buf_sz / chp->pack_sz;
+	size_t step = npx / chp->n_tasks;
+	build_range(chp, ind * step, (ind + 1) * step, true);
+}
+
+static void clear_task(void* tag, size_t ind)
+{
+	struct rwstat_ch_priv* chp = tag;
+	size_t ntw = chp->base * chp->base;
+	size_t step = ntw / chp->n_tasks;
+
+	shmif_pixel val = RGBA(0x00, 0x00, 0x00, 0xff);
+	shmif_pixel* px = &chp->out[ind * step];
+	for (size_t i = 0; i < step; i++)
+		px[i] = val;
+}
+
+static size_t frame_tasks(struct rwstat_ch_priv* chp)
+{
+	size_t nt = 1;
+	while (nt < (pool.n_threads + 1) * 2 && nt < chp->base)
+		nt *= 2;
+	return nt;
+}
+
+/*
+ * The parent only has to update (upload) the region that changed, this
+ * needs a shmif that supports SHMIF_RHINT_SUBREGION (ENABLE_SUBREGION
+ * in the build), otherwise the whole frame is always assumed to change.
+ */
+static void out_signal(struct rwstat_ch_priv* chp, const struct rw_region* r)
+{
+	if (chp->sink){
+		chp->sink->signal(chp->self, chp->sink->tag);
+		return;
+	}
+
+#ifdef SHMIF_SUBREGION
+	if (!chp->subregion){
+		chp->cont->hints |= SHMIF_RHINT_SUBREGION;
+		arcan_shmif_resize(chp->cont, chp->cont->addr->w, chp->cont->addr->h);
+		chp->subregion = true;
+	}
+
+	chp->cont->dirty.x1 = r->x1;
+	chp->cont->dirty.y1 = r->y1;
+	chp->cont->dirty.x2 = r->x2;
+	chp->cont->dirty.y2 = r->y2;
+#endif
+
+	arcan_shmif_signal(chp->cont, SHMIF_SIGVID);
+}
+
+static void out_event(struct rwstat_ch_priv* chp, arcan_event* ev)
+{
+	if (chp->sink)
+		chp->sink->event(chp->self, ev, chp->sink->tag);
+	else
+		arcan_shmif_enqueue(chp->cont, ev);
+}
+
+/*
+ * wait until the output buffer can be written to (the staged frame, if
+ * any, has been copied to the segment) and point the kernels at it
+ */
+static void acquire_output(struct rwstat_ch_priv* chp)
+{
+	if (!chp->pipe.stage){
+		chp->out = chp->cont->vidp;
+		chp->out_pitch = chp->cont->addr->w;
+		return;
+	}
+
+	pthread_mutex_lock(&chp->pipe.lock);
+	while (chp->pipe.pending)
+		pthread_cond_wait(&chp->pipe.cond, &chp->pipe.lock);
+	pthread_mutex_unlock(&chp->pipe.lock);
+
+	chp->out = chp->pipe.stage;
+	chp->out_pitch = chp->base;
+}
+
+static void clear_frame(struct rwstat_ch_priv* chp)
+{
+	size_t ntw = chp->base * chp->base;
+	acquire_output(chp);
+	memset(chp->tuple_mask, '\0', sizeof(chp->tuple_mask));
+
+	if (ntw >= par_min_px && pool.n_threads){
+		chp->n_tasks = frame_tasks(chp);
+		if (pool_run(clear_task, chp, chp->n_tasks))
+			return;
+	}
+
+	shmif_pixel val = RGBA(0x00, 0x00, 0x00, 0xff);
+	for (size_t i = 0; i < ntw; i++)
+		chp->out[i] = val;
+}
+
+/*
+ * MAP_TUPLE can only have plotted one pixel per (first, second) byte
+ * pair, so clearing those is enough and touches at most 64k pixels
+ * regardless of base
+ */
+static void clear_tuples(struct rwstat_ch_priv* chp)
+{
+	shmif_pixel val = RGBA(0x00, 0x00, 0x00, 0xff);
+
+	for (size_t i = 0; i < 1024; i++){
+		uint64_t m = chp->tuple_mask[i];
+
+		while (m){
+			size_t v = i * 64 + __builtin_ctzll(m);
+			size_t x = (float)(v >> 8) * chp->sf_x;
+			size_t y = (float)(v & 0xff) * chp->sf_y;
+			chp->out[chp->out_pitch * y + x] = val;
+			m &= m - 1;
+		}
+
+		chp->tuple_mask[i] = 0;
+	}
+}
+
+static void build_frame(struct rwstat_ch_priv* chp)
+{
+	size_t npx = chp->buf_sz / chp->pack_sz;
+	bool seq = chp->amode == RW_ALPHA_PTN && chp->ac.stateful;
+
+	if (!seq && npx >= par_min_px && pool.n_threads){
+		chp->n_tasks = frame_tasks(chp);
+		if (pool_run(build_task, chp, chp->n_tasks)){
+			if (chp->map == MAP_TUPLE)
+				tuple_range(chp, npx);
+			return;
+		}
+	}
+
+	build_range(chp, 0, npx, false);
+	if (chp->map == MAP_TUPLE)
+		tuple_range(chp, npx);
+}
+
+/*
+ * Handoff thread for pipelined channels, copies the staged frame into
+ * the segment and then blocks in the synch while the next frame is
+ * being built.
+ */
+static void* pipe_worker(void* tag)
+{
+	struct rwstat_ch_priv* chp = tag;
+	pthread_mutex_lock(&chp->pipe.lock);
+
+	while (chp->pipe.alive){
+		if (!chp->pipe.pending){
+			pthread_cond_wait(&chp->pipe.cond, &chp->pipe.lock);
+			continue;
+		}
+
+		chp->pipe.busy = true;
+		shmif_pixel* vidp = chp->cont->vidp;
+		size_t pitch = chp->cont->addr->w;
+		struct rw_region r = chp->pipe_reg;
+
+/* the rest of the segment already matches the stage */
+		if (pitch == chp->base && r.x1 == 0 && r.x2 == chp->base)
+			memcpy(&vidp[r.y1 * pitch], &chp->pipe.stage[r.y1 * chp->base],
+				sizeof(shmif_pixel) * chp->base * (r.y2 - r.y1));
+		else
+			for (size_t y = r.y1; y < r.y2; y++)
+				memcpy(&vidp[y * pitch + r.x1], &chp->pipe.stage[y * chp->base + r.x1],
+					sizeof(shmif_pixel) * (r.x2 - r.x1));
+
+		chp->pipe.pending = false;
+		pthread_cond_broadcast(&chp->pipe.cond);
+		pthread_mutex_unlock(&chp->pipe.lock);
+
+		out_signal(chp, &r);
+
+		pthread_mutex_lock(&chp->pipe.lock);
+		chp->pipe.busy = false;
+		pthread_cond_broadcast(&chp->pipe.cond);
+	}
+
+	pthread_mutex_unlock(&chp->pipe.lock);
+	return NULL;
+}
+
+static void pipe_submit(struct rwstat_ch_priv* chp, const struct rw_region* r)
+{
+	pthread_mutex_lock(&chp->pipe.lock);
+	chp->pipe_reg = *r;
+	chp->pipe.pending = true;
+	pthread_cond_broadcast(&chp->pipe.cond);
+	pthread_mutex_unlock(&chp->pipe.lock);
+}
+
+static void pipe_sync(struct rwstat_ch_priv* chp)
+{
+	if (!chp->pipe.stage)
+		return;
+
+	pthread_mutex_lock(&chp->pipe.lock);
+	while (chp->pipe.pending || chp->pipe.busy)
+		pthread_cond_wait(&chp->pipe.cond, &chp->pipe.lock);
+	pthread_mutex_unlock(&chp->pipe.lock);
+}
+
+static void pipe_stop(struct rwstat_ch_priv* chp)
+{
+	if (!chp->pipe.stage)
+		return;
+
+	pipe_sync(chp);
+	pthread_mutex_lock(&chp->pipe.lock);
+	chp->pipe.alive = false;
+	pthread_cond_broadcast(&chp->pipe.cond);
+	pthread_mutex_unlock(&chp->pipe.lock);
+	pthread_join(chp->pipe.thread, NULL);
+
+	pthread_mutex_destroy(&chp->pipe.lock);
+	pthread_cond_destroy(&chp->pipe.cond);
+	free(chp->pipe.stage);
+	chp->pipe.stage = NULL;
+}
+
+static inline void region_add(struct rw_region* r, size_t x, size_t y)
+{
+	r->x1 = x < r->x1 ? x : r->x1;
+	r->y1 = y < r->y1 ? y : r->y1;
+	r->x2 = x + 1 > r->x2 ? x + 1 : r->x2;
+	r->y2 = y + 1 > r->y2 ? y + 1 : r->y2;
+}
+
+/*
+ * Resolve the damage hint to the pixels it can affect in the current
+ * mapping, widened to the entropy block or the possible pattern matches
+ * around the changed bytes. Returns false when that can't be bounded
+ * (or isn't worth it) and the whole frame should be treated as new.
+ */
+static bool damage_region(struct rwstat_ch_priv* chp, struct rw_region* r)
+{
+	size_t npx = chp->buf_sz / chp->pack_sz;
+	size_t b1 = chp->dmg.b1;
+	size_t b2 = chp->dmg.b2;
+
+/* histogram packing depends on all data, tuple on the values and
+ * the ring clocks shift every byte to a new position */
+	if (!chp->dmg.set || chp->dmg.full ||
+		chp->map == MAP_TUPLE || chp->pack == PACK_HINTENS ||
+		chp->clock != RW_CLK_BLOCK || b1 >= b2)
+		return false;
+
+	if (chp->amode == RW_ALPHA_PTN){
+		if (chp->ptn_persist || chp->ac.stateful)
+			return false;
+
+		size_t ovl = chp->ac.max_len ? chp->ac.max_len - 1 : 0;
+		b1 = b1 > ovl ? b1 - ovl : 0;
+		b2 = b2 + ovl;
+	}
+
+	size_t p1 = b1 / chp->pack_sz;
+	size_t p2 = (b2 + chp->pack_sz - 1) / chp->pack_sz;
+	if (chp->amode == RW_ALPHA_ENTBASE){
+		size_t win = ent_window(chp);
+		if (chp->ent_slide){
+			p1 = p1 > win ? p1 - win : 0;
+			p2 += win;
+		}
+		else {
+			p1 -= p1 % win;
+			p2 = (p2 + win - 1) / win * win;
+		}
+	}
+	p2 = p2 > npx ? npx : p2;
+
+	if (chp->map == MAP_WRAP){
+		size_t y1 = p1 / chp->base;
+		size_t y2 = (p2 - 1) / chp->base + 1;
+		*r = (struct rw_region){0, y1, chp->base, y2};
+		if (y2 - y1 == 1){
+			r->x1 = p1 % chp->base;
+			r->x2 = (p2 - 1) % chp->base + 1;
+		}
+		return true;
+	}
+
+/* the curves keep spans compact, but a large one will cover most of
+ * the frame anyway */
+	if (p2 - p1 > npx / 2)
+		return false;
+
+	*r = (struct rw_region){chp->base, chp->base, 0, 0};
+	for (size_t i = p1; i < p2; i++){
+		if (chp->map == MAP_HILBERT)
+			region_add(r, chp->cmap[i * 2], chp->cmap[i * 2 + 1]);
+		else
+			region_add(r, morton_compact(i), morton_compact(i >> 1));
+	}
+
+	return true;
+}
+
+/*
+ * Summarize the patterns that matched in the frame, "ptn:<n>:" followed
+ * by id,count,first; entries (hex, first is the byte offset within the
+ * frame) and continued in "ptn+:" messages until all n have been sent,
+ * so heavy matching costs a few events per frame rather than one per
+ * pattern.
+ */
+static void ptn_report(struct rwstat_ch_priv* chp)
+{
+	size_t n = 0;
 	for (size_t i = 0; i < chp->n_patterns; i++)
-		if (chp->patterns[i].evc){
-			arcan_event ev = {
-				.category = EVENT_EXTERNAL,
-				.ext.kind = EVENT_EXTERNAL_CURSORINPUT,
-				.ext.cursor.id = chp->patterns[i].id,
-				.ext.cursor.x = chp->patterns[i].evc
-			};
-			arcan_shmif_enqueue(chp->cont, &ev);
-			chp->patterns[i].evc = 0;
+		if (chp->patterns[i].evc)
+			n++;
+
+	if (!n)
+		return;
+
+	arcan_event ev = {
+		.category = EVENT_EXTERNAL,
+		.ext.kind = EVENT_EXTERNAL_MESSAGE
+	};
+	char* msg = (char*) ev.ext.message;
+	size_t cap = sizeof(ev.ext.message) / sizeof(ev.ext.message[0]);
+	size_t pos = snprintf(msg, cap, "ptn:%zu:", n);
+
+	for (size_t i = 0; i < chp->n_patterns; i++){
+		struct pattern* ptn = &chp->patterns[i];
+		if (!ptn->evc)
+			continue;
+
+		char ent[40];
+		size_t len = snprintf(ent, sizeof(ent), "%x,%x,%zx;",
+			(unsigned) ptn->id, (unsigned) ptn->evc, ptn->first);
+
+		if (pos + len >= cap){
+			out_event(chp, &ev);
+			memset(msg, '\0', cap);
+			pos = snprintf(msg, cap, "ptn+:");
+		}
+
+		memcpy(&msg[pos], ent, len);
+		pos += len;
+		ptn->evc = 0;
+		ptn->first = SIZE_MAX;
+	}
+
+	out_event(chp, &ev);
+}
+
+/*
+ * Byte histogram of the frame as "hgram:<i>:<hex>" messages, i = 0..7
+ * with 32 bins each scaled to the largest bin (00..ff), followed by
+ * "hgram:8:<max>:<total>" with the unscaled largest bin and byte count
+ * that completes the set.
+ */
+static void hgram_report(struct rwstat_ch_priv* chp)
+{
+	uint32_t local[256];
+	const uint32_t* hg = chp->hgram;
+
+/* the running histogram only matches the frame for the sliding clock */
+	if (chp->clock != RW_CLK_SLIDE){
+		memset(local, '\0', sizeof(local));
+		hgram_add(local, chp->src, chp->buf_sz);
+		hg = local;
+	}
+
+	uint32_t max = 0;
+	uint64_t total = 0;
+	for (size_t i = 0; i < 256; i++){
+		max = hg[i] > max ? hg[i] : max;
+		total += hg[i];
+	}
+
+	arcan_event ev = {
+		.category = EVENT_EXTERNAL,
+		.ext.kind = EVENT_EXTERNAL_MESSAGE
+	};
+	char* msg = (char*) ev.ext.message;
+	size_t cap = sizeof(ev.ext.message) / sizeof(ev.ext.message[0]);
+
+	for (size_t i = 0; i < 8; i++){
+		size_t pos = snprintf(msg, cap, "hgram:%zu:", i);
+		for (size_t j = i * 32; j < (i + 1) * 32; j++){
+			unsigned v = max ? ((uint64_t) hg[j] * 255 + max - 1) / max : 0;
+			pos += snprintf(&msg[pos], cap - pos, "%02x", v);
+		}
+		out_event(chp, &ev);
+	}
+
+	snprintf(msg, cap, "hgram:8:%u:%llu", (unsigned) max, (unsigned long long) total);
+	out_event(chp, &ev);
+}
+
+/*
+ * Roughly once a second, report throughput and the average time per
+ * frame spent in each stage as "tel:kB/s:fps:ent:ptn:pack:wait:drop/s"
+ * (times in microseconds), wait is the time blocked on the parent, in
+ * the synch or waiting for the pipeline handoff.
+ */
+static void tel_report(struct rwstat_ch_priv* chp)
+{
+	unsigned long long now = arcan_timemillis();
+	unsigned long long dt = now - chp->tel.last;
+	if (dt < 1000)
+		return;
+
+	uint64_t nf = chp->tel.frames ? chp->tel.frames : 1;
+	arcan_event ev = {
+		.category = EVENT_EXTERNAL,
+		.ext.kind = EVENT_EXTERNAL_MESSAGE
+	};
+
+	snprintf((char*)ev.ext.message, sizeof(ev.ext.message) /
+		sizeof(ev.ext.message[0]), "tel:%u:%u:%u:%u:%u:%u:%u",
+		(unsigned)(chp->tel.bytes * 1000 / dt / 1024),
+		(unsigned)(chp->tel.frames * 1000 / dt),
+		(unsigned)(chp->tel.ent / nf / 1000),
+		(unsigned)(chp->tel.ptn / nf / 1000),
+		(unsigned)(chp->tel.pack / nf / 1000),
+		(unsigned)(chp->tel.wait / nf / 1000),
+		(unsigned)((chp->cnt_drop - chp->tel.drop) * 1000 / dt)
+	);
+	out_event(chp, &ev);
+
+	chp->tel.last = now;
+	chp->tel.drop = chp->cnt_drop;
+	chp->tel.bytes = chp->tel.frames = 0;
+	chp->tel.ent = chp->tel.ptn = chp->tel.pack = chp->tel.wait = 0;
+}
+
+/*
+ * Only frames that are a function of the borrowed bytes and the modes
+ * can be reused, the histogram packing follows the running histogram
+ * and persistent pattern state carries over from the previous frame.
+ */
+static bool fc_usable(struct rwstat_ch_priv* chp)
+{
+	return chp->fc.budget && chp->fc.valid && chp->clock == RW_CLK_BLOCK &&
+		chp->pack != PACK_HINTENS &&
+		!(chp->amode == RW_ALPHA_PTN && chp->ptn_persist);
+}
+
+/* drop entries from the least recently used end until need bytes fit */
+static void fc_evict(struct rwstat_ch_priv* chp, size_t need)
+{
+	while (chp->fc.first && chp->fc.used + need > chp->fc.budget){
+		struct fc_ent** last = &chp->fc.first;
+		while ((*last)->next)
+			last = &(*last)->next;
+
+		chp->fc.used -= (*last)->sz;
+		free(*last);
+		*last = NULL;
+	}
+}
+
+static struct fc_ent* fc_find(struct rwstat_ch_priv* chp)
+{
+	for (struct fc_ent** cur = &chp->fc.first; *cur; cur = &(*cur)->next){
+		struct fc_ent* ent = *cur;
+		if (ent->key != chp->fc.key || ent->base != chp->base ||
+			ent->pack != chp->pack || ent->map != chp->map ||
+			ent->amode != chp->amode || ent->ptn_ver != chp->ptn_ver ||
+			ent->ent_win != ent_window(chp) || ent->ent_slide != chp->ent_slide)
+			continue;
+
+		*cur = ent->next;
+		ent->next = chp->fc.first;
+		chp->fc.first = ent;
+		return ent;
+	}
+
+	return NULL;
+}
+
+/* copy the frame that was just built, before the pattern report resets
+ * the per-frame counters */
+static void fc_store(struct rwstat_ch_priv* chp)
+{
+	size_t npx = chp->base * chp->base;
+	size_t n_hits = chp->amode == RW_ALPHA_PTN ? chp->n_patterns : 0;
+	size_t nmask = chp->map == MAP_TUPLE ? sizeof(chp->tuple_mask) : 0;
+	size_t sz = sizeof(struct fc_ent) + sizeof(shmif_pixel) * npx +
+		nmask + sizeof(struct fc_hit) * n_hits;
+
+	if (sz > chp->fc.budget)
+		return;
+
+	fc_evict(chp, sz);
+	struct fc_ent* ent = malloc(sz);
+	if (!ent)
+		return;
+
+	*ent = (struct fc_ent){
+		.key = chp->fc.key,
+		.base = chp->base,
+		.pack = chp->pack,
+		.map = chp->map,
+		.amode = chp->amode,
+		.ent_win = ent_window(chp),
+		.ent_slide = chp->ent_slide,
+		.ptn_ver = chp->ptn_ver,
+		.sz = sz,
+		.n_hits = n_hits
+	};
+
+	ent->px = (shmif_pixel*) &ent[1];
+	for (size_t y = 0; y < chp->base; y++)
+		memcpy(&ent->px[y * chp->base], &chp->out[y * chp->out_pitch],
+			sizeof(shmif_pixel) * chp->base);
+
+	uint8_t* tail = (uint8_t*) &ent->px[npx];
+	if (nmask){
+		ent->tuple_mask = (uint64_t*) tail;
+		memcpy(ent->tuple_mask, chp->tuple_mask, nmask);
+		tail += nmask;
+	}
+
+	ent->hits = (struct fc_hit*) tail;
+	for (size_t i = 0; i < n_hits; i++){
+		ent->hits[i].evc = chp->patterns[i].evc;
+		ent->hits[i].first = chp->patterns[i].first;
+	}
+
+	ent->next = chp->fc.first;
+	chp->fc.first = ent;
+	chp->fc.used += sz;
+}
+
+static void fc_restore(struct rwstat_ch_priv* chp, const struct fc_ent* ent)
+{
+	for (size_t y = 0; y < chp->base; y++)
+		memcpy(&chp->out[y * chp->out_pitch], &ent->px[y * chp->base],
+			sizeof(shmif_pixel) * chp->base);
+
+	if (ent->tuple_mask)
+		memcpy(chp->tuple_mask, ent->tuple_mask, sizeof(chp->tuple_mask));
+
+	for (size_t i = 0; i < ent->n_hits; i++){
+		chp->patterns[i].evc = ent->hits[i].evc;
+		chp->patterns[i].first = ent->hits[i].first;
+	}
+}
+
+/*
+ * running total of dropped bytes as "drop:<n>", only sent when it has
+ * changed so streams that never drop don't pay for it
+ */
+static void drop_report(struct rwstat_ch_priv* chp)
+{
+	arcan_event ev = {
+		.category = EVENT_EXTERNAL,
+		.ext.kind = EVENT_EXTERNAL_MESSAGE
+	};
+
+	snprintf((char*) ev.ext.message, sizeof(ev.ext.message) /
+		sizeof(ev.ext.message[0]), "drop:%llu",
+		(unsigned long long) chp->cnt_drop);
+
+	chp->drop_sent = chp->cnt_drop;
+	out_event(chp, &ev);
+}
+
+/*
+ * RW_CLK_TIMED, what was overwritten in the ring before it could be
+ * shown is accounted as dropped. Unless the frame continues exactly
+ * where the last one ended, persistent pattern state can't carry over.
+ */
+static void timed_skip(struct rwstat_ch_priv* chp)
+{
+	if (chp->tm.pending > chp->buf_sz)
+		chp->cnt_drop += chp->tm.pending - chp->buf_sz;
+
+	if (chp->tm.pending != chp->buf_sz){
+		chp->ac_state = 0;
+		chp->ac_av = 0xff;
+	}
+
+	chp->tm.pending = 0;
+}
+
+/*
+ * RW_CLK_TIMED, the frame covers only part of what the hits were
+ * counted over, so a pattern can have hits without a first offset
+ */
+static void timed_hits(struct rwstat_ch_priv* chp)
+{
+	for (size_t i = 0; i < chp->n_patterns; i++){
+		struct pattern* ptn = &chp->patterns[i];
+		if (ptn->tevc > ptn->evc){
+			ptn->evc = ptn->tevc;
+			if (ptn->first == SIZE_MAX)
+				ptn->first = chp->buf_sz;
 		}
+		ptn->tevc = 0;
+	}
 }
 
 /*
@@ -282,20 +1921,26 @@ static void update_ptnalpha(struct rwstat_ch_priv* chp)
 static void ch_step(struct rwstat_ch* ch)
 {
 	struct rwstat_ch_priv* chp = ch->priv;
+	if (chp->clock == RW_CLK_TIMED)
+		timed_skip(chp);
 
 	struct arcan_event outev = {
 		.category = EVENT_EXTERNAL,
 		.ext.kind = EVENT_EXTERNAL_FRAMESTATUS,
 		.ext.framestatus.framenumber = ch->priv->cnt_local,
-		.ext.framestatus.pts = ch->priv->cnt_total,
+		.ext.framestatus.pts = chp->cnt_total,
 		.ext.framestatus.acquired = arcan_timemillis(),
 	};
 
-	size_t ntw = chp->base * chp->base;
-	outev.ext.framestatus.fhint = shent_h(chp->buf,
-			chp->buf_sz, chp->hgram) / 8.0;
+	outev.ext.framestatus.fhint = shent_h(chp, chp->hgram) / 8.0;
 	ch->event(ch, &outev);
 
+	if (chp->cnt_drop != chp->drop_sent)
+		drop_report(chp);
+
+	if (chp->tel.on)
+		tel_report(chp);
+
 /*
  * Notify about the packing mode active for this frame. This is
  * needed for the parent to be able to determine what each byte
@@ -312,33 +1957,168 @@ static void ch_step(struct rwstat_ch* ch)
 		ch->event(ch, &outev);
 	}
 
-	if ( 1 == (chp->clock & (RW_CLK_SLIDE)) )
-		rebuild_hgram(chp);
-
 	if (chp->pack == PACK_HINTENS)
-		hnorm(chp->hgram);
-	if (chp->amode == RW_ALPHA_ENTBASE)
-		update_entalpha(chp, chp->base);
-	else if (chp->amode == RW_ALPHA_PTN)
-		update_ptnalpha(chp);
+		hnorm(chp->hgram, chp->hgram_norm);
 
-	for (size_t i = 0; i < chp->buf_sz; i+= chp->pack_sz)
-		pack_bytes(chp, &chp->buf[i], i / chp->pack_sz);
+	if (chp->amode == RW_ALPHA_PTN){
+		if (chp->ac_dirty){
+			chp->ac_dirty = false;
+			ac_build(chp);
+		}
 
-	arcan_shmif_signal(chp->cont, SHMIF_SIGVID);
-	chp->cnt_local = chp->cnt_total;
+		for (size_t i = 0; i < chp->n_patterns; i++){
+			chp->patterns[i].evc = 0;
+			chp->patterns[i].first = SIZE_MAX;
+		}
+	}
+
+	struct rw_region reg;
+	if (!damage_region(chp, &reg))
+		reg = (struct rw_region){0, 0, chp->base, chp->base};
+	chp->dmg.set = chp->dmg.full = false;
+
+	uint64_t ts = chp->tel.on ? tel_ns() : 0;
+	acquire_output(chp);
+	tel_add(chp, &chp->tel.wait, &ts);
+
+/* a cached copy replaces every pixel of the output */
+	struct fc_ent* hit = fc_usable(chp) ? fc_find(chp) : NULL;
+	if (hit){
+		fc_restore(chp, hit);
+		reg = (struct rw_region){0, 0, chp->base, chp->base};
+		tel_add(chp, &chp->tel.pack, &ts);
+	}
+	else {
+/* only the pixels plotted in the last frame need to be reset */
+		if (chp->map == MAP_TUPLE)
+			clear_tuples(chp);
+
+/* all stages are complete when this returns */
+		build_frame(chp);
+		if (fc_usable(chp))
+			fc_store(chp);
+	}
 
-/* non-sparse mappings require an output flush */
-	if (chp->map == MAP_TUPLE){
-		shmif_pixel val = RGBA(0x00, 0x00, 0x00, 0xff);
-		for (size_t i = 0; i < ntw; i++)
-			chp->cont->vidp[i] = val;
+	if (chp->amode == RW_ALPHA_PTN){
+		if (chp->clock == RW_CLK_TIMED)
+			timed_hits(chp);
+		ptn_report(chp);
 	}
+
+	if (chp->hgram_export)
+		hgram_report(chp);
+
+	if (chp->tel.on)
+		ts = tel_ns();
+
+	if (chp->pipe.stage)
+		pipe_submit(chp, &reg);
+	else
+		out_signal(chp, &reg);
+
+	tel_add(chp, &chp->tel.wait, &ts);
+	chp->tel.frames++;
+	chp->cnt_local = chp->cnt_total;
+	chp->tm.last = outev.ext.framestatus.acquired;
 }
 
 static void ch_event(struct rwstat_ch* ch, arcan_event* ev)
 {
-	arcan_shmif_enqueue(ch->priv->cont, ev);
+	out_event(ch->priv, ev);
+}
+
+/*
+ * RW_CLK_TIMED, count pattern hits over everything that is ingested as
+ * most of it will never be part of a frame
+ */
+static void timed_scan(struct rwstat_ch_priv* chp, const uint8_t* buf, size_t n)
+{
+	if (chp->ac_dirty){
+		chp->ac_dirty = false;
+		ac_build(chp);
+	}
+
+	struct ptn_ac* ac = &chp->ac;
+	if (!ac->next)
+		return;
+
+	uint32_t st = chp->tm.ac_state;
+	for (size_t i = 0; i < n; i++){
+		st = ac->next[st][ buf[i] ];
+
+		uint32_t m = ac->out[st] >= 0 ? st : ac->dict[st];
+		while (m){
+			for (int32_t k = ac->out[m]; k >= 0; k = ac->out_next[k])
+				if (chp->patterns[k].flags & FLAG_EVENT)
+					chp->patterns[k].tevc++;
+			m = ac->dict[m];
+		}
+	}
+
+	chp->tm.ac_state = st;
+}
+
+/*
+ * RW_CLK_TIMED ingests without bound, so the histogram is halved each
+ * time it would hold more than timed_hg_lim bytes. That keeps the bins
+ * within 32 bits and weights the estimate towards recent data.
+ */
+static const size_t timed_hg_lim = (size_t) 1 << 30;
+
+static void timed_hgram(struct rwstat_ch_priv* chp, const uint8_t* buf, size_t n)
+{
+	while (n){
+		size_t nb = n < timed_hg_lim ? n : timed_hg_lim;
+		while (chp->tm.hg_n + nb > timed_hg_lim){
+			chp->tm.hg_n = 0;
+			for (size_t i = 0; i < 256; i++){
+				chp->hgram[i] >>= 1;
+				chp->tm.hg_n += chp->hgram[i];
+			}
+		}
+
+		hgram_add(chp->hgram, buf, nb);
+		chp->tm.hg_n += nb;
+		buf += nb;
+		n -= nb;
+	}
+}
+
+/*
+ * RW_CLK_TIMED, every write is consumed but only the part that can
+ * still be in the latest full buffer is copied into the ring, and a
+ * frame is built once the interval since the last one has passed
+ */
+static size_t timed_data(struct rwstat_ch* ch,
+	uint8_t* buf, size_t buf_sz, int* step)
+{
+	struct rwstat_ch_priv* chp = ch->priv;
+	chp->tel.bytes += buf_sz;
+	chp->tm.pending += buf_sz;
+	timed_hgram(chp, buf, buf_sz);
+
+	if (chp->amode == RW_ALPHA_PTN && chp->n_patterns)
+		timed_scan(chp, buf, buf_sz);
+
+	size_t ntw = buf_sz < chp->buf_sz ? buf_sz : chp->buf_sz;
+	uint8_t* src = &buf[buf_sz - ntw];
+	size_t n1 = chp->buf_sz - chp->head;
+	n1 = n1 < ntw ? n1 : ntw;
+
+	memcpy(&chp->buf[chp->head], src, n1);
+	memcpy(chp->buf, &src[n1], ntw - n1);
+	chp->head += ntw;
+	if (chp->head >= chp->buf_sz)
+		chp->head -= chp->buf_sz;
+
+	if (arcan_timemillis() - chp->tm.last < chp->tm.interval){
+		*step = 0;
+		return buf_sz;
+	}
+
+	*step = 1;
+	ch_step(ch);
+	return buf_sz;
 }
 
 static size_t ch_data(struct rwstat_ch* ch,
@@ -346,29 +2126,43 @@ static size_t ch_data(struct rwstat_ch* ch,
 {
 	struct rwstat_ch_priv* chp = ch->priv;
 	size_t ntw;
+	chp->src = chp->buf;
+	chp->fc.valid = chp->fc.pending = false;
 
-/* larger write chunks are equivalent to a block slide,
- * so use the CLK_BLOCK mode for those */
+	if (chp->clock == RW_CLK_TIMED)
+		return timed_data(ch, buf, buf_sz, step);
+
+/* sliding window, the oldest bytes are evicted from the ring and the
+ * histogram so each write costs O(n) in the size of the write, larger
+ * writes are capped to a full buffer slide */
 	if (ch->priv->clock == RW_CLK_SLIDE){
-		if (buf_sz < chp->buf_sz){
-			ntw = buf_sz;
-			chp->buf_ofs = chp->buf_sz - ntw;
-			memmove(chp->buf, chp->buf + ntw, chp->buf_ofs);
+		ntw = buf_sz < chp->buf_sz ? buf_sz : chp->buf_sz;
+		chp->tel.bytes += ntw;
+
+		for (size_t i = 0; i < ntw; i++){
+			uint8_t* dst = &chp->buf[chp->head];
+			chp->hgram[ *dst ]--;
+			chp->hgram[ buf[i] ]++;
+			*dst = buf[i];
+
+			if (++chp->head == chp->buf_sz)
+				chp->head = 0;
 		}
-		else
-			ntw = chp->buf_sz;
-	}
-	else
-		ntw = buf_sz < (chp->buf_sz - chp->buf_ofs) ?
-			buf_sz : chp->buf_sz - chp->buf_ofs;
 
-/* add to remap buffer and histogram,
- * histogram need to be rebuilt for CLK_SLIDE but add > branch */
-	for (size_t i = 0; i < ntw; i++){
-		chp->hgram[ buf[i] ]++;
-		chp->buf[ chp->buf_ofs++ ] = buf[i];
+		*step = 1;
+		ch_step(ch);
+		return ntw;
 	}
 
+	ntw = buf_sz < (chp->buf_sz - chp->buf_ofs) ?
+		buf_sz : chp->buf_sz - chp->buf_ofs;
+	chp->tel.bytes += ntw;
+
+/* add to remap buffer and histogram */
+	memcpy(&chp->buf[chp->buf_ofs], buf, ntw);
+	hgram_add(chp->hgram, buf, ntw);
+	chp->buf_ofs += ntw;
+
 	if (chp->buf_ofs == chp->buf_sz){
 		chp->buf_ofs = 0;
 		*step = 1;
@@ -380,13 +2174,53 @@ static size_t ch_data(struct rwstat_ch* ch,
 	return ntw;
 }
 
+/*
+ * a full block can be built straight from the caller's memory, which is
+ * then referenced (for mode switches that rebuild the frame) until the
+ * next data, clock switch or resize
+ */
+static void ch_damage(struct rwstat_ch* ch, size_t ofs, size_t len)
+{
+	struct rwstat_ch_priv* chp = ch->priv;
+	size_t end = ofs + len;
+
+	if (!chp->dmg.set){
+		chp->dmg.b1 = ofs;
+		chp->dmg.b2 = end;
+		chp->dmg.set = true;
+		return;
+	}
+
+	chp->dmg.b1 = ofs < chp->dmg.b1 ? ofs : chp->dmg.b1;
+	chp->dmg.b2 = end > chp->dmg.b2 ? end : chp->dmg.b2;
+}
+
+static size_t ch_borrow(struct rwstat_ch* ch,
+	uint8_t* buf, size_t buf_sz, int* step)
+{
+	struct rwstat_ch_priv* chp = ch->priv;
+	if (chp->clock != RW_CLK_BLOCK || chp->buf_ofs != 0 || buf_sz < chp->buf_sz)
+		return ch_data(ch, buf, buf_sz, step);
+
+	chp->src = buf;
+	chp->fc.valid = chp->fc.pending;
+	chp->fc.key = chp->fc.next;
+	chp->fc.pending = false;
+	chp->tel.bytes += chp->buf_sz;
+	hgram_add(chp->hgram, buf, chp->buf_sz);
+
+	*step = 1;
+	ch_step(ch);
+	return chp->buf_sz;
+}
+
 static bool ch_pattern(struct rwstat_ch* ch,
 	uint8_t alpha, uint32_t id, enum ptn_flags fl, void* buf, size_t buf_sz)
 {
 	struct rwstat_ch_priv* chp = ch->priv;
 	if (chp->n_patterns+1 > chp->patterns_sz){
-		void* rbuf = realloc(chp->patterns,
-			(chp->patterns_sz + 8) * sizeof(struct pattern));
+		size_t nsz = chp->patterns_sz ? chp->patterns_sz * 2 : 8;
+		void* rbuf = realloc(chp->patterns, nsz * sizeof(struct pattern));
 
 		if (!rbuf){
 			free(buf);
@@ -394,8 +2228,9 @@ static bool ch_pattern(struct rwstat_ch* ch,
 		}
 
 		chp->patterns = rbuf;
-		memset(&chp->patterns[chp->n_patterns], '\0', sizeof(struct pattern) * 8);
-		chp->patterns_sz += 8;
+		memset(&chp->patterns[chp->patterns_sz], '\0',
+			sizeof(struct pattern) * (nsz - chp->patterns_sz));
+		chp->patterns_sz = nsz;
 	}
 
 	struct pattern* newp = &chp->patterns[chp->n_patterns++];
@@ -405,6 +2240,10 @@ static bool ch_pattern(struct rwstat_ch* ch,
 	newp->alpha = alpha;
 	newp->id = id;
 	newp->flags = fl;
+	newp->first = SIZE_MAX;
+	chp->ac_dirty = true;
+	chp->ptn_ver++;
+	chp->dmg.full = true;
 
 	return true;
 }
@@ -426,12 +2265,14 @@ static void ch_pack(struct rwstat_ch* ch, enum rwstat_pack pack)
 
 /* number of bytes we need to fill one shmif_pixel */
 	chp->pack_sz = pack_sizes[pack];
+	chp->kernel = kernels[chp->map][pack];
 
 /* then number of bytes we need in order to map coordinates */
 	switch(ch->priv->map){
 	case MAP_WRAP: break; /* can use the buf_ofs value for this */
 	case MAP_TUPLE: chp->pack_sz += 2; break;
 	case MAP_HILBERT: break; /* can use the buf_ofs value for this */
+	case MAP_MORTON: break;
 	}
 
 /* since packing size might have changed, we need to do a sanity check */
@@ -439,62 +2280,79 @@ static void ch_pack(struct rwstat_ch* ch, enum rwstat_pack pack)
 		ch->resize(ch, chp->base);
 
 	chp->status_dirty = true;
+	chp->dmg.full = true;
 }
 
 static void ch_map(struct rwstat_ch* ch, enum rwstat_mapping map)
 {
 	struct rwstat_ch_priv* chp = ch->priv;
-	chp->map = map;
 
-	if (chp->cmap){
-		free(chp->cmap);
-		chp->cmap = NULL;
+/* some mapping modes need a LUT for the ofs = F(X,Y), take the new one
+ * first so that remapping at the same base is just a cache hit */
+	const uint16_t* cmap = lut_get(map, chp->base);
+	if (map == MAP_HILBERT && !cmap){
+		fprintf(stderr, "rwstat:ch_map(), couldn't build LUT for %zu\n",
+			chp->base);
+		map = MAP_WRAP;
 	}
 
-	size_t hsz = ch->priv->base * ch->priv->base;
-
-/* some mapping modes need a LUT for the ofs = F(X,Y) */
-	if (map == MAP_WRAP || map == MAP_TUPLE)
-		;
-	else if (map == MAP_HILBERT){
-		uint16_t* cmap = malloc( 2 * 2 * hsz );
-		for (size_t i = 0; i < hsz; i++){
-			int x, y;
-			hilbert_d2xy(ch->priv->base, i, &x, &y);
-			cmap[i * 2 + 0] = x;
-			cmap[i * 2 + 1] = y;
-		}
-		chp->cmap = cmap;
-	}
+	lut_put(chp->cmap);
+	chp->cmap = cmap;
+	chp->map = map;
 
 /* changing mapping mode may require different packing dimensions */
 	ch_pack(ch, chp->pack);
 
 /* reset the buffer to reflect change in mapping mode, this doesn't
  * matter in CLK_BYTES but for other modes */
-	if (map == MAP_TUPLE){
-		shmif_pixel val = RGBA(0x00, 0x00, 0x00, 0xff);
-		size_t ntw = chp->base * chp->base;
-		for (size_t i = 0; i < ntw; i++)
-			chp->cont->vidp[i] = val;
-	}
+	if (map == MAP_TUPLE)
+		clear_frame(chp);
 
 	chp->status_dirty = true;
+	chp->dmg.full = true;
 	ch_step(ch);
 }
 
 static void ch_alpha(struct rwstat_ch* ch, enum rwstat_alpha amode)
 {
 	ch->priv->amode = amode;
+	ch->priv->dmg.full = true;
 	if (0 == amode)
 		memset(ch->priv->alpha, 0xff, ch->priv->base * ch->priv->base);
 }
 
 static void ch_reclock(struct rwstat_ch* ch, enum rwstat_clock clock)
 {
+	struct rwstat_ch_priv* chp = ch->priv;
+	if (chp->clock == clock)
+		return;
+
+/* the ring has to own its contents */
+	if (chp->src != chp->buf){
+		memcpy(chp->buf, chp->src, chp->buf_sz);
+		chp->src = chp->buf;
+	}
+	chp->fc.valid = false;
+
+/* partial block: anything after buf_ofs is older than [0, buf_ofs) so
+ * that becomes the ring head, the histogram has to match the contents */
+	if (clock == RW_CLK_BLOCK)
+		ring_linearize(chp);
+	else {
+		if (chp->clock == RW_CLK_BLOCK){
+			chp->head = chp->buf_ofs == chp->buf_sz ? 0 : chp->buf_ofs;
+			chp->buf_ofs = 0;
+		}
+		rebuild_hgram(chp);
+	}
+	chp->tm.pending = 0;
+	chp->tm.hg_n = chp->buf_sz;
+
+	chp->dmg.full = true;
+
 /*	ch_step(ch); - somewhat uncertain if there is any valid point
  *	in enforcing a step on the change of clocking function */
-	ch->priv->clock = clock;
+	chp->clock = clock;
 }
 
 static size_t ch_rowsz(struct rwstat_ch* ch)
@@ -505,10 +2363,23 @@ static size_t ch_rowsz(struct rwstat_ch* ch)
 static void ch_free(struct rwstat_ch** ch)
 {
 	struct rwstat_ch_priv* chp = (*ch)->priv;
+	pipe_stop(chp);
+
 	for (size_t i = 0; i < chp->patterns_sz; i++){
 		free(chp->patterns[i].buf);
 	}
 	free(chp->patterns);
+	ac_free(&chp->ac);
+	chp->fc.budget = 0;
+	fc_evict(chp, 0);
+	arena_free(&chp->arena);
+	lut_put(chp->cmap);
+
+	if (chp->sink){
+		free(chp->cont->vidp);
+		free(chp->cont->addr);
+		free(chp->cont);
+	}
 
 	memset((*ch)->priv, '\0', sizeof(struct rwstat_ch_priv));
 	free((*ch)->priv);
@@ -524,11 +2395,7 @@ static size_t ch_left(struct rwstat_ch* ch)
 
 static void ch_resize(struct rwstat_ch* ch, size_t base)
 {
-/* initial state, black! */
-	if (ch->priv->buf){
-		free(ch->priv->buf);
-		free(ch->priv->alpha);
-	}
+	pipe_sync(ch->priv);
 
 /*
  * It is possible to change mapping without elaborate sliding buffer
@@ -537,23 +2404,165 @@ static void ch_resize(struct rwstat_ch* ch, size_t base)
  * how large the raw buffer needs to be.
  */
 	size_t bsqr = base * base;
-	ch->priv->buf_sz = bsqr * ch->priv->pack_sz;
-	ch->priv->buf = malloc(ch->priv->buf_sz);
-	ch->priv->alpha = malloc(bsqr);
+	size_t buf_sz = bsqr * ch->priv->pack_sz;
+	size_t ent_nb = base * ch->priv->pack_sz;
+	if (!arena_reset(&ch->priv->arena, arena_align(buf_sz) +
+		arena_align(bsqr) + arena_align(sizeof(float) * (ent_nb + 1))))
+		return;
+
+/* headless has no parent to negotiate the size with */
+	struct arcan_shmif_cont* c = ch->priv->cont;
+	if (ch->priv->sink && base != c->addr->w){
+		shmif_pixel* vidp = realloc(c->vidp, sizeof(shmif_pixel) * base * base);
+		if (!vidp)
+			return;
+		memset(vidp, '\0', sizeof(shmif_pixel) * base * base);
+		c->vidp = vidp;
+		c->addr->w = c->addr->h = base;
+	}
+
+	if (ch->priv->pipe.stage && base != ch->priv->base){
+		shmif_pixel* stage = realloc(ch->priv->pipe.stage,
+			sizeof(shmif_pixel) * base * base);
+		if (stage){
+			ch->priv->pipe.stage = stage;
+			memset(stage, '\0', sizeof(shmif_pixel) * base * base);
+		}
+		else
+			pipe_stop(ch->priv);
+	}
+
+/* initial state, black! */
+	ch->priv->buf_sz = buf_sz;
+	ch->priv->buf = arena_take(&ch->priv->arena, buf_sz);
+	ch->priv->src = ch->priv->buf;
+	ch->priv->fc.valid = false;
+	ch->priv->alpha = arena_take(&ch->priv->arena, bsqr);
 
 	memset(ch->priv->buf, '\0', ch->priv->buf_sz);
 	memset(ch->priv->alpha, 0xff, bsqr);
+	ch->priv->buf_ofs = 0;
+	ch->priv->head = 0;
+	ch->priv->ac_state = 0;
+	ch->priv->tm.pending = 0;
+	if (ch->priv->clock == RW_CLK_SLIDE)
+		rebuild_hgram(ch->priv);
 	ch->priv->base = base;
 	ch->priv->sf_x = (float) (base-1) / 255.0f;
 	ch->priv->sf_y = (float) (base-1) / 255.0f;
 
+/* entropy is calculated per row- sized block */
+	build_entlut(ch->priv, arena_take(&ch->priv->arena,
+		sizeof(float) * (ent_nb + 1)), ent_nb);
+
 /* will setup / rebuild LUTs etc. */
 	ch_map(ch, ch->priv->map);
 }
 
 static void ch_wind(struct rwstat_ch* ch, off_t ofs)
 {
+/* discontinuity, matches can't carry over */
 	ch->priv->cnt_total = ofs;
+	ch->priv->ac_state = 0;
+	ch->priv->ac_av = 0xff;
+	ch->priv->tm.ac_state = 0;
+}
+
+static void ch_drop(struct rwstat_ch* ch, size_t nb)
+{
+	ch->priv->cnt_drop += nb;
+}
+
+static void ch_telemetry(struct rwstat_ch* ch, bool on)
+{
+	struct rwstat_ch_priv* chp = ch->priv;
+	if (on && !chp->tel.on){
+		chp->tel.last = arcan_timemillis();
+		chp->tel.drop = chp->cnt_drop;
+		chp->tel.bytes = chp->tel.frames = 0;
+		chp->tel.ent = chp->tel.ptn = chp->tel.pack = chp->tel.wait = 0;
+	}
+	chp->tel.on = on;
+}
+
+static void ch_histogram(struct rwstat_ch* ch, bool on)
+{
+	ch->priv->hgram_export = on;
+}
+
+static void ch_entwin(struct rwstat_ch* ch, size_t npx, bool slide)
+{
+	ch->priv->ent_win = npx;
+	ch->priv->ent_slide = slide;
+	ch->priv->dmg.full = true;
+}
+
+static void ch_frame_rate(struct rwstat_ch* ch, unsigned fps)
+{
+	ch->priv->tm.interval = 1000 / (fps ? fps : 30);
+}
+
+static void ch_frame_cache(struct rwstat_ch* ch, size_t budget)
+{
+	ch->priv->fc.budget = budget;
+	fc_evict(ch->priv, 0);
+}
+
+static void ch_cache_key(struct rwstat_ch* ch, uint64_t key)
+{
+	ch->priv->fc.next = key;
+	ch->priv->fc.pending = true;
+}
+
+static bool ch_pipeline(struct rwstat_ch* ch, bool on)
+{
+	struct rwstat_ch_priv* chp = ch->priv;
+	if (!on){
+		pipe_stop(chp);
+		return true;
+	}
+
+	if (chp->pipe.stage)
+		return true;
+
+/* start from what is already in the segment as not every frame will
+ * overwrite every pixel */
+	size_t pitch = chp->cont->addr->w;
+	chp->pipe.stage = malloc(sizeof(shmif_pixel) * chp->base * chp->base);
+	if (!chp->pipe.stage)
+		return false;
+
+	for (size_t y = 0; y < chp->base; y++)
+		memcpy(&chp->pipe.stage[y * chp->base], &chp->cont->vidp[y * pitch],
+			sizeof(shmif_pixel) * chp->base);
+
+	pthread_mutex_init(&chp->pipe.lock, NULL);
+	pthread_cond_init(&chp->pipe.cond, NULL);
+	chp->pipe.alive = true;
+	chp->pipe.pending = chp->pipe.busy = false;
+
+	if (0 != pthread_create(&chp->pipe.thread, NULL, pipe_worker, chp)){
+		pthread_mutex_destroy(&chp->pipe.lock);
+		pthread_cond_destroy(&chp->pipe.cond);
+		free(chp->pipe.stage);
+		chp->pipe.stage = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+static void ch_sync(struct rwstat_ch* ch)
+{
+	pipe_sync(ch->priv);
+}
+
+static void ch_ptnpersist(struct rwstat_ch* ch, bool persist)
+{
+	ch->priv->ptn_persist = persist;
+	ch->priv->dmg.full = true;
+	ch->priv->ac_state = 0;
+	ch->priv->ac_av = 0xff;
 }
 
 bool rwstat_consume_event(struct rwstat_ch* ch, struct arcan_event* ev)
@@ -568,6 +2577,9 @@ bool rwstat_consume_event(struct rwstat_ch* ch, struct arcan_event* ev)
 	case 1:
 	 	ch->switch_clock(ch, RW_CLK_SLIDE);
 	break;
+	case 2:
+		ch->switch_clock(ch, RW_CLK_TIMED);
+	break;
 	case 10:
 		ch->switch_mapping(ch, MAP_WRAP);
 	break;
@@ -577,6 +2589,9 @@ bool rwstat_consume_event(struct rwstat_ch* ch, struct arcan_event* ev)
 	case 12:
 		ch->switch_mapping(ch, MAP_HILBERT);
 	break;
+	case 13:
+		ch->switch_mapping(ch, MAP_MORTON);
+	break;
 	case 20:
 		ch->switch_packing(ch, PACK_INTENS);
 	break;
@@ -593,11 +2608,50 @@ bool rwstat_consume_event(struct rwstat_ch* ch, struct arcan_event* ev)
 		ch->switch_alpha(ch, RW_ALPHA_FULL);
 	break;
 	case 31:
+		ch->persist_patterns(ch, false);
 		ch->switch_alpha(ch, RW_ALPHA_PTN);
 	break;
 	case 32:
 		ch->switch_alpha(ch, RW_ALPHA_ENTBASE);
 	break;
+	case 33:
+		ch->persist_patterns(ch, true);
+		ch->switch_alpha(ch, RW_ALPHA_PTN);
+	break;
+	case 40:
+		ch->telemetry(ch, false);
+	break;
+	case 41:
+		ch->telemetry(ch, true);
+	break;
+	case 50:
+		ch->histogram(ch, false);
+	break;
+	case 51:
+		ch->histogram(ch, true);
+	break;
+	case 60:
+	case 61:
+	case 62:
+	case 63:
+	case 64:
+	case 65:
+	case 66:
+	case 67:
+		ch->entropy_window(ch, ev->tgt.ioevs[0].iv == 60 ? 0 :
+			ch->priv->base >> (ev->tgt.ioevs[0].iv - 60), false);
+	break;
+	case 70:
+	case 71:
+	case 72:
+	case 73:
+	case 74:
+	case 75:
+	case 76:
+	case 77:
+		ch->entropy_window(ch, ev->tgt.ioevs[0].iv == 70 ? 0 :
+			ch->priv->base >> (ev->tgt.ioevs[0].iv - 70), true);
+	break;
 	default:
 		fprintf(stderr, "Senseye:FDsense:dispatch_event(),"
 			" unknown graphmode: %d\n", ev->tgt.ioevs[0].iv);
@@ -621,10 +2675,10 @@ bool rwstat_consume_event(struct rwstat_ch* ch, struct arcan_event* ev)
  *  - injection point / trigger (in-place replace data)
  *  - enable / disable other pattern on activation
  *
- * The big caveat is that these are constrained and reset to each
- * synched buffer transfer, as the number of edge conditions when
- * taking seeking/stepping/clock modes etc. into account is a bit
- * too much.
+ * The patterns are compiled into one automaton when the next frame
+ * is built. Match state is reset at each synched buffer transfer
+ * unless persist_patterns has been enabled, then matches can span
+ * frames until the next discontinuity (wind_ofs, resize).
  */
 void rwstat_addpatterns(struct rwstat_ch* ch, struct arg_arr* arg)
 {
@@ -678,21 +2732,183 @@ void rwstat_addpatterns(struct rwstat_ch* ch, struct arg_arr* arg)
 	}
 }
 
-struct rwstat_ch* rwstat_addch(
+/*
+ * Pattern set snapshot for rwstat_search. Candidates are found on the
+ * first byte of the patterns alone (memchr for one distinct first byte,
+ * 16 bytes at a time against a few of them, a table otherwise) and then
+ * verified against the patterns that start with that byte.
+ */
+#define SEARCH_VEC_FIRST 4
+
+struct rwstat_search {
+	struct pattern* patterns;
+	size_t n_patterns;
+	size_t max_len;
+
+/* index of the first pattern per first byte, chained through link */
+	int32_t first[256];
+	int32_t* link;
+
+	uint8_t fb[SEARCH_VEC_FIRST];
+	size_t n_fb;
+};
+
+struct rwstat_search* rwstat_search_new(struct rwstat_ch* ch)
+{
+	struct rwstat_ch_priv* chp = ch->priv;
+	struct rwstat_search* s = malloc(sizeof(struct rwstat_search));
+	if (!s)
+		return NULL;
+
+	*s = (struct rwstat_search){0};
+	s->patterns = malloc(sizeof(struct pattern) * (chp->n_patterns + 1));
+	s->link = malloc(sizeof(int32_t) * (chp->n_patterns + 1));
+	if (!s->patterns || !s->link){
+		rwstat_search_free(s);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < 256; i++)
+		s->first[i] = -1;
+
+	size_t n_first = 0;
+	for (size_t i = 0; i < chp->n_patterns; i++){
+		struct pattern* ptn = &chp->patterns[i];
+		if (!ptn->buf_sz)
+			continue;
+
+		uint8_t* buf = malloc(ptn->buf_sz);
+		if (!buf){
+			rwstat_search_free(s);
+			return NULL;
+		}
+		memcpy(buf, ptn->buf, ptn->buf_sz);
+
+		size_t ind = s->n_patterns++;
+		s->patterns[ind] = *ptn;
+		s->patterns[ind].buf = buf;
+		s->max_len = ptn->buf_sz > s->max_len ? ptn->buf_sz : s->max_len;
+
+/* keep the chains in pattern order, later duplicates report after */
+		int32_t* dst = &s->first[buf[0]];
+		if (*dst == -1){
+			if (n_first < SEARCH_VEC_FIRST)
+				s->fb[n_first] = buf[0];
+			n_first++;
+		}
+		while (*dst != -1)
+			dst = &s->link[*dst];
+		*dst = ind;
+		s->link[ind] = -1;
+	}
+
+	s->n_fb = n_first;
+	return s;
+}
+
+size_t rwstat_search_maxlen(struct rwstat_search* s)
+{
+	return s ? s->max_len : 0;
+}
+
+void rwstat_search_free(struct rwstat_search* s)
+{
+	if (!s)
+		return;
+
+	for (size_t i = 0; s->patterns && i < s->n_patterns; i++)
+		free(s->patterns[i].buf);
+	free(s->patterns);
+	free(s->link);
+	free(s);
+}
+
+/* next position in [i, n) that holds the first byte of any pattern */
+static size_t search_next(
+	struct rwstat_search* s, const uint8_t* buf, size_t i, size_t n)
+{
+	if (s->n_fb == 1){
+		const uint8_t* p = memchr(&buf[i], s->fb[0], n - i);
+		return p ? p - buf : n;
+	}
+
+#if defined(__SSE2__)
+	if (s->n_fb <= SEARCH_VEC_FIRST){
+		__m128i fb[SEARCH_VEC_FIRST];
+		for (size_t j = 0; j < s->n_fb; j++)
+			fb[j] = _mm_set1_epi8(s->fb[j]);
+
+		for (; i + 16 <= n; i += 16){
+			__m128i v = _mm_loadu_si128((const __m128i*) &buf[i]);
+			__m128i m = _mm_cmpeq_epi8(v, fb[0]);
+			for (size_t j = 1; j < s->n_fb; j++)
+				m = _mm_or_si128(m, _mm_cmpeq_epi8(v, fb[j]));
+
+			int mask = _mm_movemask_epi8(m);
+			if (mask)
+				return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+
+	for (; i < n; i++)
+		if (s->first[buf[i]] != -1)
+			return i;
+
+	return n;
+}
+
+size_t rwstat_search(struct rwstat_search* s,
+	const uint8_t* buf, size_t n, size_t avail,
+	void (*hit)(size_t ofs, uint32_t id, void* tag), void* tag)
+{
+	size_t count = 0;
+	if (!s || !s->n_fb)
+		return 0;
+
+	for (size_t i = search_next(s, buf, 0, n); i < n;
+		i = search_next(s, buf, i + 1, n)){
+
+		for (int32_t j = s->first[buf[i]]; j != -1; j = s->link[j]){
+			struct pattern* ptn = &s->patterns[j];
+			if (ptn->buf_sz > avail - i ||
+				memcmp(&buf[i + 1], &ptn->buf[1], ptn->buf_sz - 1) != 0)
+				continue;
+
+			hit(i, ptn->id, tag);
+			count++;
+		}
+	}
+
+	return count;
+}
+
+/*
+ * the sink has to be in place before the first resize, as that already
+ * steps and would otherwise signal / enqueue on the segment
+ */
+static struct rwstat_ch* ch_new(
 	enum rwstat_clock mode, enum rwstat_mapping map, enum rwstat_pack pack,
- 	struct arcan_shmif_cont* c)
+	struct arcan_shmif_cont* c, struct rwstat_sink* sink)
 {
-	if (!c)
+	struct rwstat_ch* res = malloc(sizeof(struct rwstat_ch));
+	struct rwstat_ch_priv* priv = malloc(sizeof(struct rwstat_ch_priv));
+	if (!res || !priv){
+		free(res);
+		free(priv);
 		return NULL;
+	}
 
-	struct rwstat_ch* res;
-	res = malloc(sizeof(struct rwstat_ch));
 	memset(res, '\0', sizeof(struct rwstat_ch));
-	res->priv = malloc(sizeof(struct rwstat_ch_priv));
-	memset(res->priv, '\0', sizeof(struct rwstat_ch_priv));
+	memset(priv, '\0', sizeof(struct rwstat_ch_priv));
+	res->priv = priv;
 
 	res->priv->cont = c;
+	res->priv->sink = sink;
+	res->priv->self = res;
 	res->data = ch_data;
+	res->borrow = ch_borrow;
+	res->damage = ch_damage;
 	res->priv->clock = mode;
 	res->switch_packing = ch_pack;
 	res->switch_mapping = ch_map;
@@ -703,16 +2919,71 @@ struct rwstat_ch* rwstat_addch(
 	res->free = ch_free;
 	res->event = ch_event;
 	res->wind_ofs = ch_wind;
+	res->drop = ch_drop;
 	res->resize = ch_resize;
 	res->add_pattern = ch_pattern;
+	res->persist_patterns = ch_ptnpersist;
+	res->pipeline = ch_pipeline;
+	res->telemetry = ch_telemetry;
+	res->histogram = ch_histogram;
+	res->entropy_window = ch_entwin;
+	res->frame_rate = ch_frame_rate;
+	res->frame_cache = ch_frame_cache;
+	res->cache_key = ch_cache_key;
+	res->sync = ch_sync;
 	res->left = ch_left;
 	res->row_size = ch_rowsz;
 
 	res->priv->map = map;
 	res->priv->pack = pack;
 	res->priv->amode = RW_ALPHA_ENTBASE;
+	res->priv->ac_av = 0xff;
+	res->frame_rate(res, 0);
 	res->resize(res, c->addr->w);
 	res->priv->status_dirty = true;
 
 	return res;
 }
+
+struct rwstat_ch* rwstat_addch(
+	enum rwstat_clock mode, enum rwstat_mapping map, enum rwstat_pack pack,
+ 	struct arcan_shmif_cont* c)
+{
+	if (!c)
+		return NULL;
+
+	return ch_new(mode, map, pack, c, NULL);
+}
+
+struct rwstat_ch* rwstat_addch_headless(
+	enum rwstat_clock mode, enum rwstat_mapping map, enum rwstat_pack pack,
+	size_t base, struct rwstat_sink* sink)
+{
+	if (!sink || !sink->signal || !sink->event || !base)
+		return NULL;
+
+	struct arcan_shmif_cont* c = malloc(sizeof(struct arcan_shmif_cont));
+	struct arcan_shmif_page* page = malloc(sizeof(struct arcan_shmif_page));
+	shmif_pixel* vidp = malloc(sizeof(shmif_pixel) * base * base);
+	if (!c || !page || !vidp){
+		free(c);
+		free(page);
+		free(vidp);
+		return NULL;
+	}
+
+	memset(c, '\0', sizeof(struct arcan_shmif_cont));
+	memset(page, '\0', sizeof(struct arcan_shmif_page));
+	memset(vidp, '\0', sizeof(shmif_pixel) * base * base);
+	page->w = page->h = base;
+	c->addr = page;
+	c->vidp = vidp;
+
+	struct rwstat_ch* res = ch_new(mode, map, pack, c, sink);
+	if (!res){
+		free(c);
+		free(page);
+		free(vidp);
+	}
+	return res;
+}
@@ -13,7 +13,8 @@ static const int rwstat_row_ch = 6;
  */
 enum rwstat_clock {
 	RW_CLK_BLOCK  = 0, /* Full block by block (base-squared) */
-	RW_CLK_SLIDE  = 1  /* On every new write- flush          */
+	RW_CLK_SLIDE  = 1, /* On every new write- flush          */
+	RW_CLK_TIMED  = 2  /* Latest block, at most N per second */
 };
 
 /*
@@ -32,6 +33,7 @@ enum rwstat_mapping {
 	MAP_WRAP    = 0, /* increment y, reset x after filled row          */
 	MAP_TUPLE   = 1, /* first, second bytes (X, Y) and pack third byte */
 	MAP_HILBERT = 2, /* use a hilbert space filling curve              */
+	MAP_MORTON  = 3, /* z-order curve, interleaved x / y offset bits   */
 };
 
 /*
@@ -47,7 +49,7 @@ enum rwstat_pack {
 };
 
 enum ptn_flags {
-	FLAG_EVENT = 1, /* if set, event will be fired when detected during synch */
+	FLAG_EVENT = 1, /* if set, hits are included in the per-frame summary    */
 	FLAG_STATE = 2  /* if set, alpha value will be used until next state- ptn */
 };
 
@@ -61,12 +63,30 @@ struct rwstat_ch {
  */
 	size_t (*data)(struct rwstat_ch*, uint8_t* buf, size_t buf_sz, int* fs);
 
+/*
+ * Same as data, but when there is no partial frame pending in
+ * RW_CLK_BLOCK and buf holds at least a full frame, the frame is built
+ * directly from buf instead of a copy. buf then has to stay valid and
+ * unchanged until the next data / borrow call, clock switch or resize,
+ * as mapping and packing switches rebuild the frame from it.
+ */
+	size_t (*borrow)(struct rwstat_ch*, uint8_t* buf, size_t buf_sz, int* fs);
+
+/*
+ * Hint that only the bytes [ofs, ofs + len) of the frame being filled
+ * differ from the previous frame, repeated calls extend the range. It
+ * applies to the next synched frame only, without it (or when the mode
+ * makes every pixel depend on all data) the whole frame is signalled.
+ */
+	void (*damage)(struct rwstat_ch*, size_t ofs, size_t len);
+
 /* get the number of bytes left until a full frame is filled given the
  * current packing / mapping sizes */
 	size_t (*left)(struct rwstat_ch*);
 	size_t (*row_size)(struct rwstat_ch*);
 
-/* force a transfer step even though parts of buffer state may be incomplete */
+/* force a transfer step even though parts of buffer state may be incomplete,
+ * in RW_CLK_TIMED this flushes the latest window regardless of the rate */
 	void (*tick)(struct rwstat_ch*);
 
 /* define a new desired base size */
@@ -78,8 +98,10 @@ struct rwstat_ch {
 /*
  * Add a byte sequence to look for. Alpha indicates the value to write
  * to the corresponding alpha channel in the output buffer, if  _TYPE
- * alpha mode is set. Id is the value to use in the event that is queued
- * when sequence is detected (along with offset).
+ * alpha mode is set. Id is the value used for the pattern in the hit
+ * summary that follows each synched frame, EVENT_EXTERNAL_MESSAGE(s)
+ * "ptn:<n>:" and "ptn+:" carrying n "id,count,first;" hex entries,
+ * where first is the byte offset of the earliest match in the frame.
  *
  * Stateful only affects _PTN alpha mode. If set, all subsequent bytes
  * (until a new pattern is triggered) will have the specified alpha
@@ -89,9 +111,88 @@ struct rwstat_ch {
 	bool (*add_pattern)(struct rwstat_ch*, uint8_t alpha, uint32_t id,
 		enum ptn_flags, void* buf, size_t sz);
 
+/*
+ * Keep pattern matching state between synched frames so that matches
+ * crossing a frame boundary are detected. Only meaningful for
+ * contiguous streams, the state is reset on wind_ofs and resize.
+ */
+	void (*persist_patterns)(struct rwstat_ch*, bool);
+
+/*
+ * Build frames into a private buffer that a separate thread copies to
+ * the segment and synchs, so that the next frame can be built while the
+ * parent is still consuming the previous one. Off by default.
+ */
+	bool (*pipeline)(struct rwstat_ch*, bool);
+
+/*
+ * Periodically (~1s) emit an EVENT_EXTERNAL_MESSAGE, "tel:" followed by
+ * ingest kB/s, frames/s, the average microseconds per frame spent on
+ * entropy, pattern alpha, packing and waiting on the parent, and dropped
+ * bytes/s, all colon separated. Off by default.
+ */
+	void (*telemetry)(struct rwstat_ch*, bool);
+
+/*
+ * After each synched frame, send the byte histogram of the frame as
+ * EVENT_EXTERNAL_MESSAGEs, "hgram:0:" to "hgram:7:" with 32 hex bins
+ * each (scaled to the largest bin) and "hgram:8:max:total" last, so the
+ * parent doesn't need to read the frame back. Off by default.
+ */
+	void (*histogram)(struct rwstat_ch*, bool);
+
+/*
+ * Window (in pixels) that RW_ALPHA_ENTBASE calculates entropy over, 0
+ * (default) is one row and larger windows are clamped to that, blocks
+ * are rounded down to a power of two. With slide set, every pixel gets
+ * the entropy of the window (any size) centered on it instead of all
+ * pixels in a block sharing one value.
+ */
+	void (*entropy_window)(struct rwstat_ch*, size_t npx, bool slide);
+
+/*
+ * Upper bound on synched frames per second for RW_CLK_TIMED (default
+ * 30, 0 restores that). Every write is consumed in full and only the
+ * latest full buffer is kept, between frames the channel just counts:
+ * bytes, the histogram (so FRAMESTATUS fhint covers all of them, with
+ * the counts halved whenever they reach 2^30 bytes so older data fades
+ * out rather than the bins overflowing) and,
+ * in RW_ALPHA_PTN, pattern hits (so the summary count does too, while
+ * first is still relative to the frame, or the frame size if all hits
+ * were in bytes that were never shown). The bytes that never made it
+ * into a frame are accounted as with drop.
+ */
+	void (*frame_rate)(struct rwstat_ch*, unsigned fps);
+
+/*
+ * Keep up to budget bytes of frames built from borrowed blocks that
+ * have been given a key, so that returning to the same block with the
+ * same modes and patterns copies the frame instead of rebuilding it.
+ * 0 (default) disables the cache and releases what it holds.
+ */
+	void (*frame_cache)(struct rwstat_ch*, size_t budget);
+
+/*
+ * Identify the bytes of the next borrow, the same key has to always
+ * mean the same bytes (e.g. an offset into a read-only file mapping).
+ * Cleared by the next data or borrow call.
+ */
+	void (*cache_key)(struct rwstat_ch*, uint64_t key);
+
+/*
+ * Block until all built frames have been handed to the parent, this
+ * must be done before the segment is resized or dropped.
+ */
+	void (*sync)(struct rwstat_ch*);
+
 /* change the offset counter that is propagated in parent communication */
 	void (*wind_ofs)(struct rwstat_ch*, off_t val);
 
+/* account for stream bytes that were skipped before reaching the channel,
+ * each synched frame after the total has changed is followed by an
+ * EVENT_EXTERNAL_MESSAGE "drop:<total>" (decimal) */
+	void (*drop)(struct rwstat_ch*, size_t nb);
+
 /* switch how each byte value is mapped into color channels,
  * using the enumerators defined above */
 	void (*switch_packing)(struct rwstat_ch*, enum rwstat_pack);
@@ -111,6 +212,28 @@ struct rwstat_ch* rwstat_addch(enum rwstat_clock clock,
 	struct arcan_shmif_cont*
 );
 
+/*
+ * Output for channels that aren't connected to a parent (benchmarks,
+ * offline processing), signal is invoked for every synched frame with
+ * the completed frame in context(ch)->vidp and event for everything the
+ * channel would have enqueued. With pipeline enabled, signal is invoked
+ * from the handoff thread rather than the one feeding the channel.
+ */
+struct rwstat_sink {
+	void (*signal)(struct rwstat_ch*, void* tag);
+	void (*event)(struct rwstat_ch*, arcan_event*, void* tag);
+	void* tag;
+};
+
+/*
+ * Create a new channel that builds into a private base * base buffer and
+ * reports through sink (which has to outlive the channel).
+ */
+struct rwstat_ch* rwstat_addch_headless(enum rwstat_clock clock,
+	enum rwstat_mapping map, enum rwstat_pack pack,
+	size_t base, struct rwstat_sink* sink
+);
+
 /*
  * See if an incoming arcan- style event contains data that
  * should be mapped to the rwstat. This is to re-se more of
@@ -121,6 +244,37 @@ struct rwstat_ch* rwstat_addch(enum rwstat_clock clock,
  */
 bool rwstat_consume_event(struct rwstat_ch*, struct arcan_event*);
 
+/*
+ * Setup a process-wide pool of n worker threads that all channels can
+ * use to build large frames in parallel (n = 0 tears down the pool,
+ * which is also the default). Returns false if no thread could be made.
+ */
+bool rwstat_workers(size_t n);
+
+/*
+ * Snapshot of the current pattern set of a channel for searching memory
+ * outside of the channel (e.g. a whole file). The snapshot is not
+ * affected by later changes to the channel and can be used from any
+ * number of threads at once. Returns NULL on allocation failure.
+ */
+struct rwstat_search;
+struct rwstat_search* rwstat_search_new(struct rwstat_ch*);
+
+/* longest pattern in the snapshot, matches that start at the end of a
+ * span need this many bytes (minus one) past it to be found */
+size_t rwstat_search_maxlen(struct rwstat_search*);
+
+/*
+ * Invoke hit for every match that starts in buf[0, n), in increasing
+ * offset order, where matches may continue past n but not past avail
+ * (avail >= n) bytes. Returns the number of hits.
+ */
+size_t rwstat_search(struct rwstat_search*, const uint8_t* buf,
+	size_t n, size_t avail, void (*hit)(size_t ofs, uint32_t id, void* tag),
+	void* tag);
+
+void rwstat_search_free(struct rwstat_search*);
+
 /*
  * take an arg_arr packed struct and parse it to extract
  * command-line specified patterns and map them into the
@@ -0,0 +1,249 @@
+/*
+ * Copyright 2015, Björn Ståhl
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Throughput benchmark for rwstat, runs synthetic data and
+ * any files given on the command-line through every clock, mapping,
+ * packing and alpha combination on a headless channel and reports MB/s
+ * and ns/frame for each.
+ *
+ * usage: rwstat_bench [-b base] [-m megabytes] [-f frames] [-w workers] [-p]
+ *                     [-h] [file ...]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+
+#include <arcan_shmif.h>
+#include "rwstat.h"
+
+struct input {
+	const char* name;
+	uint8_t* buf;
+	size_t sz;
+};
+
+/* signal runs on the handoff thread when pipelined, hence the atomics */
+struct counters {
+	size_t frames;
+	size_t events;
+};
+
+static const char* clock_names[] = {"block", "slide", "timed"};
+static const char* map_names[] = {"wrap", "tuple", "hilbert", "morton"};
+static const char* pack_names[] = {"tight", "tnoalpha", "intens", "hintens"};
+static const char* alpha_names[] = {"full", "entbase", "ptn"};
+
+/* what could be worth highlighting in a mixed binary */
+static const char* patterns[] = {"MZ", "\x7f" "ELF", "PK\x03\x04", "%PDF"};
+
+static void sink_signal(struct rwstat_ch* ch, void* tag)
+{
+	__atomic_add_fetch(&((struct counters*)tag)->frames, 1, __ATOMIC_RELAXED);
+}
+
+static void sink_event(struct rwstat_ch* ch, arcan_event* ev, void* tag)
+{
+	__atomic_add_fetch(&((struct counters*)tag)->events, 1, __ATOMIC_RELAXED);
+}
+
+static double now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* xorshift, half of it constrained to a small alphabet so that the
+ * entropy / pattern paths see something other than noise */
+static bool synthetic(struct input* in, size_t sz)
+{
+	in->name = "synthetic";
+	in->sz = sz;
+	in->buf = malloc(sz);
+	if (!in->buf)
+		return false;
+
+	uint64_t x = 0x9e3779b97f4a7c15ull;
+	for (size_t i = 0; i < sz; i++){
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		in->buf[i] = (i / 65536) % 2 ? (uint8_t) x : "ABCD"[x & 3];
+	}
+
+	return true;
+}
+
+static bool load(struct input* in, const char* path)
+{
+	FILE* fpek = fopen(path, "r");
+	if (!fpek){
+		fprintf(stderr, "couldn't open %s (%s)\n", path, strerror(errno));
+		return false;
+	}
+
+	fseek(fpek, 0, SEEK_END);
+	long sz = ftell(fpek);
+	fseek(fpek, 0, SEEK_SET);
+
+	in->name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	in->sz = sz > 0 ? sz : 0;
+	in->buf = in->sz ? malloc(in->sz) : NULL;
+	bool rv = in->buf && fread(in->buf, 1, in->sz, fpek) == in->sz;
+	fclose(fpek);
+
+	if (!rv){
+		fprintf(stderr, "couldn't read %s\n", path);
+		free(in->buf);
+	}
+	return rv;
+}
+
+/* feed total bytes or until max_frames have been synched (sliding clocks
+ * build on every write, timed ones at most 30 times per second), wrapping
+ * around the input, in write sizes similar to what the sensors use */
+static void run(struct input* in, size_t base, size_t total,
+	size_t max_frames, bool pipeline,
+	enum rwstat_clock clk, enum rwstat_mapping map,
+	enum rwstat_pack pack, enum rwstat_alpha alpha)
+{
+	struct counters cnt = {0};
+	struct rwstat_sink sink = {
+		.signal = sink_signal,
+		.event = sink_event,
+		.tag = &cnt
+	};
+
+	struct rwstat_ch* ch = rwstat_addch_headless(clk, map, pack, base, &sink);
+	if (!ch){
+		fprintf(stderr, "couldn't create headless channel\n");
+		exit(EXIT_FAILURE);
+	}
+
+	ch->switch_mapping(ch, map);
+	ch->switch_packing(ch, pack);
+	ch->switch_alpha(ch, alpha);
+	if (pipeline)
+		ch->pipeline(ch, true);
+
+/* the channel takes ownership of the pattern buffer */
+	for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++){
+		size_t len = strlen(patterns[i]);
+		uint8_t* buf = malloc(len);
+		if (buf){
+			memcpy(buf, patterns[i], len);
+			ch->add_pattern(ch, 0x80 + i, i, FLAG_EVENT, buf, len);
+		}
+	}
+
+	size_t chunk = clk == RW_CLK_SLIDE ? 1024 : 64 * 1024;
+	size_t fed = 0, ofs = 0, built = 0;
+	int fs;
+	__atomic_store_n(&cnt.frames, 0, __ATOMIC_RELAXED);
+
+/* stop on the frames built here, the signalled count lags behind by the
+ * one in flight when pipelined and is only final after sync */
+	double start = now_ns();
+	while (fed < total && built < max_frames){
+		size_t nb = in->sz - ofs < chunk ? in->sz - ofs : chunk;
+
+/* data takes at most what is left of the frame, only count that */
+		while (nb && built < max_frames){
+			size_t n = ch->data(ch, &in->buf[ofs], nb, &fs);
+			fed += n;
+			nb -= n;
+			built += fs;
+			ofs = (ofs + n) % in->sz;
+		}
+	}
+	ch->sync(ch);
+	double elapsed = now_ns() - start;
+	size_t frames = __atomic_load_n(&cnt.frames, __ATOMIC_RELAXED);
+
+	printf("%-12.12s %-5s %-7s %-8s %-7s %9.1f MB/s %12.0f ns/frame %6zu frames\n",
+		in->name, clock_names[clk], map_names[map], pack_names[pack],
+		alpha_names[alpha], (double) fed / (elapsed / 1e9) / 1048576.0,
+		frames ? elapsed / frames : 0.0, frames);
+
+	ch->free(&ch);
+}
+
+static void usage(FILE* out)
+{
+	fprintf(out, "usage: rwstat_bench [-b base] [-m megabytes] "
+		"[-f frames] [-w workers] [-p] [-h] [file ...]\n"
+		"\t-b base       frame side, power of two (default 256)\n"
+		"\t-m megabytes  data fed per run (default 64)\n"
+		"\t-f frames     stop a run after this many frames (default 1000)\n"
+		"\t-w workers    worker pool threads (default 0, serial)\n"
+		"\t-p            pipeline frame handoff\n"
+		"\t-h            show this help\n");
+}
+
+int main(int argc, char* argv[])
+{
+	size_t base = 256;
+	size_t mb = 64;
+	size_t frames = 1000;
+	size_t workers = 0;
+	bool pipeline = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:m:f:w:ph")) != -1){
+		switch (opt){
+		case 'b': base = strtoul(optarg, NULL, 10); break;
+		case 'm': mb = strtoul(optarg, NULL, 10); break;
+		case 'f': frames = strtoul(optarg, NULL, 10); break;
+		case 'w': workers = strtoul(optarg, NULL, 10); break;
+		case 'p': pipeline = true; break;
+		case 'h':
+			usage(stdout);
+			return EXIT_SUCCESS;
+		default:
+			usage(stderr);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (base == 0 || (base & (base - 1)) != 0){
+		fprintf(stderr, "base must be a power of two\n");
+		return EXIT_FAILURE;
+	}
+
+	if (workers && !rwstat_workers(workers))
+		fprintf(stderr, "couldn't spawn worker pool, running serial\n");
+
+	size_t n_inputs = 1 + (argc - optind);
+	struct input* inputs = malloc(sizeof(struct input) * n_inputs);
+	if (!inputs || !synthetic(&inputs[0], 16 * 1024 * 1024))
+		return EXIT_FAILURE;
+
+	size_t n = 1;
+	for (int i = optind; i < argc; i++)
+		if (load(&inputs[n], argv[i]))
+			n++;
+
+	printf("base %zu, %zu MB or %zu frames per run, %zu workers%s\n",
+		base, mb, frames, workers, pipeline ? ", pipelined" : "");
+
+	for (size_t i = 0; i < n; i++)
+		for (int clk = RW_CLK_BLOCK; clk <= RW_CLK_TIMED; clk++)
+			for (int map = MAP_WRAP; map <= MAP_MORTON; map++)
+				for (int pack = PACK_TIGHT; pack <= PACK_HINTENS; pack++)
+					for (int alpha = RW_ALPHA_FULL; alpha <= RW_ALPHA_PTN; alpha++)
+						run(&inputs[i], base, mb * 1024 * 1024, frames, pipeline,
+							clk, map, pack, alpha);
+
+	for (size_t i = 0; i < n; i++)
+		free(inputs[i].buf);
+	free(inputs);
+	rwstat_workers(0);
+
+	return EXIT_SUCCESS;
+}
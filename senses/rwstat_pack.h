@@ -0,0 +1,131 @@
+/*
+ * Copyright 2015, Björn Ståhl
+ * License: 3-Clause BSD, see COPYING file in arcan source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Row packing kernels used by rwstat.c, each kernel fills n
+ * consecutive output pixels from consecutive input bytes (the stride is
+ * implied by the packing mode) and the matching slice of the alpha buffer.
+ * It is only to be included from rwstat.c.
+ */
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PACK_NEON
+#endif
+
+typedef void (*pack_row_fn)(shmif_pixel* dst, const uint8_t* src,
+	const uint8_t* alpha, const uint8_t* lut, size_t n);
+
+/*
+ * The vector paths write bytes in r, g, b, a memory order, which is only
+ * valid if RGBA() (that can be overridden at build time) agrees. This
+ * folds to a constant so the scalar fallback costs nothing when it does.
+ */
+static inline bool pack_layout_rgba8(void)
+{
+	shmif_pixel px = RGBA(1, 2, 3, 4);
+	uint8_t* b = (uint8_t*) &px;
+	return b[0] == 1 && b[1] == 2 && b[2] == 3 && b[3] == 4;
+}
+
+static inline void pack_tight(shmif_pixel* dst, const uint8_t* src,
+	const uint8_t* alpha, const uint8_t* lut, size_t n)
+{
+	if (pack_layout_rgba8()){
+		memcpy(dst, src, n * sizeof(shmif_pixel));
+		return;
+	}
+
+	for (size_t i = 0; i < n; i++, src += 4)
+		dst[i] = RGBA(src[0], src[1], src[2], src[3]);
+}
+
+static inline void pack_tnoalpha(shmif_pixel* dst, const uint8_t* src,
+	const uint8_t* alpha, const uint8_t* lut, size_t n)
+{
+	size_t i = 0;
+
+#if defined(PACK_NEON)
+	if (pack_layout_rgba8())
+		for (; i + 16 <= n; i += 16){
+			uint8x16x3_t rgb = vld3q_u8(&src[i * 3]);
+			uint8x16x4_t px = {{rgb.val[0], rgb.val[1], rgb.val[2],
+				vld1q_u8(&alpha[i])}};
+			vst4q_u8((uint8_t*) &dst[i], px);
+		}
+
+#elif defined(__SSSE3__)
+/* 16 bytes are loaded for every 12 consumed, stop early enough to
+ * never read past the end of the source */
+	if (pack_layout_rgba8()){
+		const __m128i rgbm = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+			6, 7, 8, -1, 9, 10, 11, -1);
+		const __m128i am = _mm_setr_epi8(-1, -1, -1, 0, -1, -1, -1, 1,
+			-1, -1, -1, 2, -1, -1, -1, 3);
+
+		for (; i + 6 <= n; i += 4){
+			uint32_t av;
+			memcpy(&av, &alpha[i], 4);
+			__m128i rgb = _mm_loadu_si128((const __m128i*) &src[i * 3]);
+			__m128i a = _mm_cvtsi32_si128(av);
+			_mm_storeu_si128((__m128i*) &dst[i], _mm_or_si128(
+				_mm_shuffle_epi8(rgb, rgbm), _mm_shuffle_epi8(a, am)));
+		}
+	}
+#endif
+
+	for (; i < n; i++)
+		dst[i] = RGBA(src[i*3+0], src[i*3+1], src[i*3+2], alpha[i]);
+}
+
+static inline void pack_intens(shmif_pixel* dst, const uint8_t* src,
+	const uint8_t* alpha, const uint8_t* lut, size_t n)
+{
+	size_t i = 0;
+
+#if defined(PACK_NEON)
+	if (pack_layout_rgba8())
+		for (; i + 16 <= n; i += 16){
+			uint8x16_t v = vld1q_u8(&src[i]);
+			uint8x16x4_t px = {{v, v, v, vld1q_u8(&alpha[i])}};
+			vst4q_u8((uint8_t*) &dst[i], px);
+		}
+
+#elif defined(__SSE2__)
+/* widen by interleaving (v, v) and (v, a) pairs into (v, v, v, a) */
+	if (pack_layout_rgba8())
+		for (; i + 16 <= n; i += 16){
+			__m128i v = _mm_loadu_si128((const __m128i*) &src[i]);
+			__m128i a = _mm_loadu_si128((const __m128i*) &alpha[i]);
+			__m128i vv_lo = _mm_unpacklo_epi8(v, v);
+			__m128i vv_hi = _mm_unpackhi_epi8(v, v);
+			__m128i va_lo = _mm_unpacklo_epi8(v, a);
+			__m128i va_hi = _mm_unpackhi_epi8(v, a);
+			__m128i* out = (__m128i*) &dst[i];
+			_mm_storeu_si128(&out[0], _mm_unpacklo_epi16(vv_lo, va_lo));
+			_mm_storeu_si128(&out[1], _mm_unpackhi_epi16(vv_lo, va_lo));
+			_mm_storeu_si128(&out[2], _mm_unpacklo_epi16(vv_hi, va_hi));
+			_mm_storeu_si128(&out[3], _mm_unpackhi_epi16(vv_hi, va_hi));
+		}
+#endif
+
+	for (; i < n; i++)
+		dst[i] = RGBA(src[i], src[i], src[i], alpha[i]);
+}
+
+static inline void pack_hintens(shmif_pixel* dst, const uint8_t* src,
+	const uint8_t* alpha, const uint8_t* lut, size_t n)
+{
+	for (size_t i = 0; i < n; i++){
+		uint8_t hv = lut[src[i]];
+		dst[i] = RGBA(hv, hv, hv, alpha[i]);
+	}
+}
@@ -37,6 +37,8 @@ struct {
 	enum rwstat_mapping def_map;
 	struct arg_arr* args;
 	bool paused;
+	bool pipeline;
+	unsigned fps;
 }
 opts = {
 	.def_map = MAP_WRAP,
@@ -44,10 +46,24 @@ opts = {
 	.paused = true
 };
 
+/*
+ * segment request that has been sent on the control connection but not
+ * yet answered, see senseye_open_async
+ */
+struct senseye_req {
+	struct senseye_req* next;
+	int id;
+	void (*done)(struct senseye_cont*, struct senseye_ch*, void* tag);
+	void* tag;
+};
+
 struct senseye_priv {
 	struct arcan_shmif_cont cont;
 	bool paused, running, noforward;
 	int framecount;
+
+/* control connection only, outstanding requests in the order sent */
+	struct senseye_req* pending;
 };
 
 static void dispatch_event(arcan_event* ev,
@@ -69,9 +85,11 @@ static void dispatch_event(arcan_event* ev,
 		case TARGET_COMMAND_DISPLAYHINT:
 		{
 			size_t base = ev->tgt.ioevs[0].iv;
-			if (base > 0 && (base & (base - 1)) == 0 &&
-				arcan_shmif_resize(&chp->cont, base, base))
-				ch->resize(ch, base);
+			if (base > 0 && (base & (base - 1)) == 0){
+				ch->sync(ch);
+				if (arcan_shmif_resize(&chp->cont, base, base))
+					ch->resize(ch, base);
+			}
 			else
 				FLOG("Senseye:FDsense: bad displayhint: %d\n", ev->tgt.ioevs[0].iv);
 		}
@@ -135,8 +153,16 @@ bool senseye_connect(const char* key, FILE* log,
 	unsetenv("ARCAN_CONNPATH");
 
 	opts.args = *darg;
-	if (dcont->priv->cont.addr != NULL)
+	if (dcont->priv->cont.addr != NULL){
+		const char* val;
+		if (opts.args && arg_lookup(opts.args, "workers", 0, &val))
+			rwstat_workers(strtoul(val, NULL, 10));
+		if (opts.args && arg_lookup(opts.args, "pipeline", 0, &val))
+			opts.pipeline = true;
+		if (opts.args && arg_lookup(opts.args, "fps", 0, &val))
+			opts.fps = strtoul(val, NULL, 10);
 		return true;
+	}
 
 	free(dcont->priv);
 	dcont->priv = NULL;
@@ -172,7 +198,7 @@ retry:
 		int fc;
 
 		while (chp->framecount > 0 && ntw - ofs > 0){
-			ofs += ch->in->data(ch->in, (uint8_t*) buf + ofs, ntw, &fc);
+			ofs += ch->in->data(ch->in, (uint8_t*) buf + ofs, ntw - ofs, &fc);
 			chp->framecount -= fc;
 		}
 	}
@@ -222,15 +248,99 @@ static void ch_close(struct senseye_ch* ch)
 
 	ch_flush(ch);
 
+/* free first, the channel may still be handing a frame over */
 	struct senseye_priv* chp = ch->in_pr;
-	arcan_shmif_drop(&chp->cont);
 	ch->in->free(&ch->in);
+	arcan_shmif_drop(&chp->cont);
 	chp->running = false;
 }
 
+/*
+ * the new segment has to be acquired before the next event is processed,
+ * then it is wrapped in a data channel with the default modes
+ */
+static struct senseye_ch* ch_setup(struct senseye_cont* cont)
+{
+	struct senseye_ch* rv = malloc(sizeof(struct senseye_ch));
+	struct senseye_priv* cp = malloc(sizeof(struct senseye_priv));
+	if (!rv || !cp){
+		free(rv);
+		free(cp);
+		return NULL;
+	}
+
+	*rv = (struct senseye_ch){
+		.pump  = ch_pump,
+		.data  = ch_data,
+		.seek  = ch_seek,
+		.flush = ch_flush,
+		.queue = ch_queue,
+		.close = ch_close,
+		.in_pr = cp
+	};
+
+	memset(cp, '\0', sizeof(struct senseye_priv));
+	cp->paused = true;
+	cp->running = true;
+	cp->framecount = 0;
+	cp->cont = arcan_shmif_acquire(&cont->priv->cont,
+		NULL, SEGID_SENSOR, SHMIF_DISABLE_GUARD);
+	if (!cp->cont.addr){
+		free(rv);
+		free(cp);
+		return NULL;
+	}
+
+	rv->in = rwstat_addch(RW_CLK_BLOCK,
+		opts.def_map, opts.def_pack, &cp->cont);
+	rv->in_handle = cp->cont.epipe;
+	rwstat_addpatterns(rv->in, opts.args);
+	if (opts.pipeline)
+		rv->in->pipeline(rv->in, true);
+	rv->in->frame_rate(rv->in, opts.fps);
+
+	return rv;
+}
+
+/*
+ * Answers carry the id of the request (NEWSEGMENT ioevs[3], REQFAIL
+ * ioevs[0]), if that doesn't match anything pending the parent is
+ * assumed to answer in order and the oldest request is completed.
+ */
+static bool req_complete(struct senseye_cont* cont, arcan_event* ev)
+{
+	struct senseye_priv* cpriv = cont->priv;
+	if (!cpriv->pending)
+		return false;
+
+	bool fail = ev->tgt.kind == TARGET_COMMAND_REQFAIL;
+	int id = fail ? ev->tgt.ioevs[0].iv : ev->tgt.ioevs[3].iv;
+
+	struct senseye_req** cur = &cpriv->pending;
+	while (*cur && (*cur)->id != id)
+		cur = &(*cur)->next;
+	if (!*cur)
+		cur = &cpriv->pending;
+
+	struct senseye_req* req = *cur;
+	*cur = req->next;
+
+	struct senseye_ch* ch = fail ? NULL : ch_setup(cont);
+	if (fail)
+		FLOG("Senseye: segment request %d rejected\n", req->id);
+
+	req->done(cont, ch, req->tag);
+	free(req);
+	return true;
+}
+
 static void process_event(struct senseye_cont* cont, arcan_event* ev)
 {
 	if (ev->category == EVENT_TARGET){
+		if ((ev->tgt.kind == TARGET_COMMAND_NEWSEGMENT ||
+			ev->tgt.kind == TARGET_COMMAND_REQFAIL) && req_complete(cont, ev))
+			return;
+
 		if (ev->tgt.kind == TARGET_COMMAND_STEPFRAME){
 			if (cont->refresh(cont, cont->priv->cont.vidp,
 				cont->priv->cont.addr->w,
@@ -259,79 +369,81 @@ bool senseye_pump(struct senseye_cont* cont)
 	return true;
 }
 
-struct senseye_ch* senseye_open(struct senseye_cont* cont,
-	const char* const ident, size_t base)
+bool senseye_open_async(struct senseye_cont* cont,
+	const char* const ident, size_t base,
+	void (*done)(struct senseye_cont*, struct senseye_ch*, void* tag), void* tag)
 {
-	if (!cont || !cont->priv)
-		return NULL;
+	if (!cont || !cont->priv || !done)
+		return false;
 
 	struct senseye_priv* cpriv = cont->priv;
+	struct senseye_req* req = malloc(sizeof(struct senseye_req));
+	if (!req)
+		return false;
 
-	struct senseye_ch scp = {
-		.pump  = ch_pump,
-	 	.data  = ch_data,
-		.seek  = ch_seek,
-		.flush = ch_flush,
-		.queue = ch_queue,
-		.close = ch_close
-	}, *rv = NULL;
+	*req = (struct senseye_req){
+		.id = random(),
+		.done = done,
+		.tag = tag
+	};
 
-	int tag = random();
 	arcan_event sr = {
 		.category = EVENT_EXTERNAL,
 		.ext.kind = EVENT_EXTERNAL_SEGREQ,
 		.ext.noticereq.width = base,
 		.ext.noticereq.height = base,
 		.ext.noticereq.type = SEGID_SENSOR,
-		.ext.noticereq.id = tag
+		.ext.noticereq.id = req->id
 	};
 	arcan_shmif_enqueue(&cpriv->cont, &sr);
 
+/* append, the order matters for parents that don't echo the id */
+	struct senseye_req** tail = &cpriv->pending;
+	while (*tail)
+		tail = &(*tail)->next;
+	*tail = req;
+
+	return true;
+}
+
+struct open_res {
+	struct senseye_ch* ch;
+	bool done;
+};
+
+static void open_done(struct senseye_cont* cont, struct senseye_ch* ch, void* tag)
+{
+	struct open_res* res = tag;
+	res->ch = ch;
+	res->done = true;
+}
+
+struct senseye_ch* senseye_open(struct senseye_cont* cont,
+	const char* const ident, size_t base)
+{
+	struct open_res res = {0};
+	if (!senseye_open_async(cont, ident, base, open_done, &res))
+		return NULL;
+
 /*
  * as we are blocking, we also need to interleave other
  * events that may already be queued or if the request
  * management is deferred for any (UX)- reason.
  */
-	while(arcan_shmif_wait(&cpriv->cont, &sr) != 0){
-		if (sr.category == EVENT_TARGET && (
-			sr.tgt.kind == TARGET_COMMAND_NEWSEGMENT ||
-			sr.tgt.kind == TARGET_COMMAND_REQFAIL)){
-
-			if (sr.tgt.kind == TARGET_COMMAND_REQFAIL)
-				break;
-
-			rv = malloc(sizeof(struct senseye_ch));
-			if (!rv)
+	struct senseye_priv* cpriv = cont->priv;
+	arcan_event sr;
+	while (!res.done && arcan_shmif_wait(&cpriv->cont, &sr) != 0)
+		process_event(cont, &sr);
+
+/* connection lost with the request outstanding, res is going out of scope */
+	if (!res.done)
+		for (struct senseye_req** cur = &cpriv->pending; *cur; cur = &(*cur)->next)
+			if ((*cur)->tag == &res){
+				struct senseye_req* req = *cur;
+				*cur = req->next;
+				free(req);
 				break;
+			}
 
-			*rv = scp;
-			struct senseye_priv* cp = malloc(sizeof(struct senseye_priv));
-			if (!cp)
-				goto fail;
-
-			rv->in_pr = cp;
-			cp->paused = true;
-			cp->running = true;
-			cp->framecount = 0;
-			cp->cont = arcan_shmif_acquire(&cpriv->cont,
-				NULL, SEGID_SENSOR, SHMIF_DISABLE_GUARD);
-			rv->in = rwstat_addch(RW_CLK_BLOCK,
-				opts.def_map, opts.def_pack, &cp->cont);
-			rv->in_handle = cp->cont.epipe;
-			rwstat_addpatterns(rv->in, opts.args);
-			break;
-		}
-		else
-			process_event(cont, &sr);
-	}
-
-	return rv;
-
-fail:
-	if (rv){
-		free(rv->in_pr);
-		free(rv);
-	}
-
-	return NULL;
+	return res.ch;
 }
@@ -59,3 +59,15 @@ bool senseye_pump(struct senseye_cont*);
  */
 struct senseye_ch* senseye_open(struct senseye_cont* cont,
 	const char* const ident, size_t base);
+
+/*
+ * Same as senseye_open but without waiting for the parent, the request
+ * is sent and done is invoked from senseye_pump (or a blocking
+ * senseye_open) once the parent has answered, with the new channel or
+ * NULL if the request was rejected. Any number of requests can be
+ * outstanding, so opening many channels costs one round trip. Returns
+ * false (and done is never invoked) if the request couldn't be sent.
+ */
+bool senseye_open_async(struct senseye_cont* cont,
+	const char* const ident, size_t base,
+	void (*done)(struct senseye_cont*, struct senseye_ch*, void* tag), void* tag);
@@ -1,10 +1,11 @@
 -- Copyright 2014-2015, Björn Ståhl
 -- License: 3-Clause BSD
 -- Reference: http://senseye.arcan-fe.com
--- Description: Histogram statistics tool. Most of the
--- 'heavy' lifting is done in arcan engine internals as
--- part of the calctarget feature, here we primarily
--- map UI resources and do buffer setup.
+-- Description: Histogram statistics tool. The sensor exports
+-- the byte histogram of each frame, which is drawn directly. When
+-- the source window is zoomed (the sensor is unaware of the zoom
+-- region), the 'heavy' lifting is done in arcan engine internals
+-- as part of the calctarget feature on the rendered window.
 
 local histo_popup = {
 	{
@@ -17,6 +18,52 @@ local histo_popup = {
 	}
 };
 
+--
+-- "hgram:0..7:<32 hex bins, scaled to the largest>" and then
+-- "hgram:8:<largest>:<total>" that completes the set
+--
+local function hgram_message(nw, hgram, msg)
+	local ind, data = string.match(msg, "^hgram:(%d):(%x+)$");
+	if (ind == nil) then
+		local max, total = string.match(msg, "^hgram:8:(%d+):(%d+)$");
+		if (max == nil) then
+			return false;
+		end
+
+		if (nw.zoomed or nw.bins == nil or #nw.bins ~= 256) then
+			return true;
+		end
+
+-- fraction of the bytes rather than relative to the largest bin
+		local sf = 1.0;
+		if (not nw.normalize and tonumber(total) > 0) then
+			sf = tonumber(max) / tonumber(total);
+		end
+
+		local tbl = {};
+		for i=1,256 do
+			local v = math.floor(nw.bins[i] * sf);
+			tbl[i * 3 - 2] = v;
+			tbl[i * 3 - 1] = v;
+			tbl[i * 3 - 0] = v;
+		end
+
+		local img = raw_surface(256, 1, 3, tbl);
+		if (valid_vid(img)) then
+			image_sharestorage(img, hgram);
+			delete_image(img);
+		end
+		return true;
+	end
+
+	nw.bins = nw.bins and nw.bins or {};
+	local base = tonumber(ind) * 32;
+	for i=0,31 do
+		nw.bins[base + i + 1] = tonumber(string.sub(data, i * 2 + 1, i * 2 + 2), 16);
+	end
+	return true;
+end
+
 function spawn_histogram(wnd)
 -- create composition buffer, intermediate buffer and histogram
 -- buffer. Setup a calctarget that imposes the histogram unto to
@@ -58,10 +105,21 @@ function spawn_histogram(wnd)
 	end
 	local frameh = {
 		frame = function()
-			nw.pending = nw.pending + 1;
+			if (nw.zoomed) then
+				nw.pending = nw.pending + 1;
+			end
+		end,
+		message = function(wnd, source, status)
+			return hgram_message(nw, hgram, status.message);
 		end
 	};
 
+-- all histogram windows attached to the same source share the export
+	wnd.hgram_users = (wnd.hgram_users and wnd.hgram_users or 0) + 1;
+	if (wnd.hgram_users == 1) then
+		target_graphmode(wnd.ctrl_id, 51);
+	end
+
 --
 -- highlight cursor that follows mouse motion and indicates
 -- the currently selected column (which is scaled and tracked
@@ -115,6 +173,11 @@ function spawn_histogram(wnd)
 			end
 		end
 
+		nw.parent.hgram_users = nw.parent.hgram_users - 1;
+		if (nw.parent.hgram_users == 0 and valid_vid(nw.parent.ctrl_id)) then
+			target_graphmode(nw.parent.ctrl_id, 50);
+		end
+
 		destroy(wnd, cascade);
 	end
 
@@ -122,6 +185,8 @@ function spawn_histogram(wnd)
 	nw.dispatch[BINDINGS["POPUP"]] = wnd.dispatch[BINDINGS["POPUP"]];
 
 	nw.zoom_link = function(self, wnd, txcos)
+		nw.zoomed = not (txcos[1] == 0.0 and txcos[2] == 0.0 and
+			txcos[3] == 1.0 and txcos[6] == 1.0);
 		image_set_txcos(csurf, txcos);
 		rendertarget_forceupdate(ibuf);
 		stepframe_target(ibuf);
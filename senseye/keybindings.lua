@@ -33,6 +33,7 @@ BINDINGS["STRAFE_RIGHT"] = "d"
 BINDINGS["PSENSE_PLAY_TOGGLE"] = " "
 BINDINGS["PSENSE_STEP_FRAME"]  = "RIGHT"
 BINDINGS["FSENSE_STEP_BACKWARD"] = "LEFT"
+BINDINGS["FSENSE_SEEK_HIT"] = "n" -- + META seeks to the previous hit
 
 BINDINGS["MSENSE_MAIN_UP"] = "UP"
 BINDINGS["MSENSE_MAIN_DOWN"] = "DOWN"
@@ -3,8 +3,9 @@
 -- Reference: http://senseye.arcan-fe.com
 -- Description: UI mapping for the file-specific sensor
 -- Notes:
---  * The preview window suffers from undersampling issues
---    when working with large files, see fsense.c for details
+--  * The preview window is a per-pixel reduction of the file,
+--    entropy (r), mean (g) and max (b), see fsense.c for details,
+--    or in diff mode the share of differing bytes (r) and any (b)
 --
 local rtbl = system_load("senses/psense.lua")();
 
@@ -16,6 +17,11 @@ rtbl.dispatch_sub[BINDINGS["FSENSE_STEP_BACKWARD"]] = function(wnd)
 	stepframe_target(wnd.ctrl_id, wnd.wm.meta and -2 or -1);
 end
 
+-- jump to the next / previous match of the whole-file pattern search
+rtbl.dispatch_sub[BINDINGS["FSENSE_SEEK_HIT"]] = function(wnd)
+	stepframe_target(wnd.ctrl_id, wnd.wm.meta and -3 or 3);
+end
+
 rtbl.dispatch_sub[BINDINGS["PSENSE_PLAY_TOGGLE"]] = function(wnd)
 	local meta = wnd.wm.meta;
 	if (wnd.tick) then
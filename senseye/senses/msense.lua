@@ -36,6 +36,43 @@ rtbl.dispatch_sub[BINDINGS["FSENSE_STEP_BACKWARD"]] = function(wnd)
 	stepframe_target(wnd.ctrl_id, wnd.wm.meta and -2 or -1);
 end
 
+--
+-- the sensor only rebuilds the frame when pages in the window have changed
+-- and then hints which rows they cover, flash those (linear mapping only,
+-- the other mappings scatter the rows)
+--
+local lst = {};
+for k,v in pairs(rtbl.source_listener) do
+	lst[k] = v;
+end
+
+local parent_message = lst.message;
+lst.message = function(wnd, source, status)
+	local first, count = string.match(status.message, "dirty:(%d+):(%d+)");
+	if (first == nil) then
+		return parent_message and parent_message(wnd, source, status) or false;
+	end
+
+	if (wnd.map_cur ~= 0) then
+		return true;
+	end
+
+	local sfy = wnd.height / image_storage_properties(wnd.canvas).height;
+	local hl = color_surface(wnd.width,
+		math.max(1, tonumber(count) * sfy), 255, 0, 0);
+	link_image(hl, wnd.canvas);
+	image_inherit_order(hl, true);
+	order_image(hl, 1);
+	image_mask_set(hl, MASK_UNPICKABLE);
+	move_image(hl, 0, tonumber(first) * sfy);
+	blend_image(hl, 0.5);
+	blend_image(hl, 0.0, 25);
+	expire_image(hl, 25);
+	return true;
+end
+
+rtbl.source_listener = lst;
+
 --
 -- need to create a copy of popup and add things
 --
@@ -9,8 +9,22 @@
 -- the sensor, not in the UI.
 
 local main_ev = {
+	message = function(wnd, source, status)
+		local added, gone = string.match(status.message, "maps:(%d+):(%d+)");
+		if (added) then
+			warning(string.format("msense: %d new, %d unmapped regions",
+				tonumber(added), tonumber(gone)));
+			return true;
+		end
+		return false;
+	end
 };
 
+local function refresh(wnd)
+	local iotbl = {kind = "digital", active = true, label = "REFRESH"};
+	target_input(wnd.ctrl_id, iotbl);
+end
+
 local disp = {};
 disp[BINDINGS["MSENSE_MAIN_UP"]] = function(wnd)
 	local iotbl = {kind = "digital", active = true, label = "UP"};
@@ -37,12 +51,53 @@ disp[BINDINGS["MSENSE_MAIN_SELECT"]] = function(wnd)
 	target_input(wnd.ctrl_id, iotbl);
 end
 
+-- the region list is cached in the sensor, reparse on request
+disp[BINDINGS["MSENSE_REFRESH"]] = refresh;
+
+local refresh_sub = {
+	{
+		label = "Off",
+		name = "maps_refresh_off",
+		value = 0
+	},
+};
+
+for i=1,10 do
+	table.insert(refresh_sub, {
+		label = string.format("%d ms", CLOCKRATE * 10 * i),
+		name = "maps_refresh" .. tonumber(i),
+		value = 10 * i
+	});
+end
+
+refresh_sub.handler = function(wnd, value)
+	wnd.tick_rate = value;
+	wnd.tick_value = value;
+end
+
 local rtbl = {
 	name = "msense_main",
 	source_listener = main_ev,
 	dispatch_sub = disp,
-	popup_sub = {},
+	popup_sub = {{
+		label = "Refresh Clock...",
+		submenu = refresh_sub
+	}},
 	init = function(wnd)
+		wnd.tick_rate = 0;
+		local oldtick = wnd.tick;
+		wnd.tick = function()
+			if (oldtick) then
+				oldtick(wnd);
+			end
+			if (wnd.tick_rate > 0) then
+				wnd.tick_value = wnd.tick_value - 1;
+				if (wnd.tick_value <= 0) then
+					refresh(wnd);
+					wnd.tick_value = wnd.tick_rate;
+				end
+			end
+		end
 	end
 };
 
@@ -60,6 +60,11 @@ local alpha_sub = {
 		label = "Pattern Signal",
 		name  = "map_alpha_signal",
 		value = 1
+	},
+	{
+		label = "Pattern Signal (Stream)",
+		name  = "map_alpha_signal_stream",
+		value = 3
 	}
 };
 
@@ -86,6 +91,11 @@ local space_sub = {
 		label = "Hilbert",
 		name  = "map_hilbert",
 		value = 2
+	},
+	{
+		label = "Morton",
+		name  = "map_morton",
+		value = 3
 	}
 };
 
@@ -103,6 +113,11 @@ local clock_sub = {
 		label = "Sliding Window",
 		name  = "clk_slide",
 		value = 1
+	},
+	{
+		label = "Timed",
+		name  = "clk_timed",
+		value = 2
 	}
 };
 
@@ -129,6 +144,115 @@ clock_sub.handler = function(wnd, value)
 	target_graphmode(wnd.ctrl_id, value);
 end
 
+--
+-- entropy (metadata) window, 60 + n splits each row in 2^n blocks,
+-- 70 + n is the same size centered on each pixel
+--
+local entwin_sub = {
+	{
+		label = "Row",
+		name  = "entwin_row",
+		value = 60
+	},
+	{
+		label = "1/4 Row",
+		name  = "entwin_4",
+		value = 62
+	},
+	{
+		label = "1/16 Row",
+		name  = "entwin_16",
+		value = 64
+	},
+	{
+		label = "1/64 Row",
+		name  = "entwin_64",
+		value = 66
+	},
+	{
+		label = "Sliding Row",
+		name  = "entwin_slide_row",
+		value = 70
+	},
+	{
+		label = "Sliding 1/16 Row",
+		name  = "entwin_slide_16",
+		value = 74
+	}
+};
+
+entwin_sub.handler = function(wnd, value)
+	target_graphmode(wnd.ctrl_id, value);
+end
+
+local tel_sub = {
+	{
+		label = "On",
+		name  = "tel_on",
+		value = 1
+	},
+	{
+		label = "Off",
+		name  = "tel_off",
+		value = 0
+	}
+};
+
+tel_sub.handler = function(wnd, value)
+	if (value == 0 and valid_vid(wnd.tel_msg)) then
+		delete_image(wnd.tel_msg);
+		wnd.tel_msg = nil;
+	end
+	target_graphmode(wnd.ctrl_id, 40 + value);
+end
+
+--
+-- rwstat telemetry, tel:kB/s:fps:entropy:pattern:pack:wait:dropped/s with
+-- stage times in microseconds per frame. Kept in a slot of its own in the
+-- upper left corner so that it doesn't fight with the cursor messages.
+--
+local function show_telemetry(wnd, msg)
+	local v = {string.match(msg,
+		"tel:(%d+):(%d+):(%d+):(%d+):(%d+):(%d+):(%d+)")};
+	if (#v ~= 7) then
+		return false;
+	end
+
+	if (valid_vid(wnd.tel_msg)) then
+		delete_image(wnd.tel_msg);
+	end
+
+	local str = string.format("%d kB/s, %d fps\\n\\r" ..
+		"entropy %d, pattern %d, pack %d, wait %d us/frame", v[1], v[2],
+		v[3], v[4], v[5], v[6]);
+	if (tonumber(v[7]) > 0) then
+		str = str .. string.format("\\n\\rdropped %d B/s", v[7]);
+	end
+
+	local img = render_text(menu_text_fontstr .. str);
+	if (not valid_vid(img)) then
+		return true;
+	end
+
+	local props = image_surface_properties(img);
+	local bg = color_surface(props.width + 10, props.height + 5, 64, 64, 64);
+	blend_image(bg, 0.8);
+	show_image(img);
+	move_image(img, 5, 2);
+	image_inherit_order(img, true);
+	link_image(img, bg);
+	link_image(bg, wnd.canvas, ANCHOR_UL);
+	image_inherit_order(bg, true);
+	order_image(bg, 2);
+	image_mask_set(bg, MASK_UNPICKABLE);
+	image_mask_set(img, MASK_UNPICKABLE);
+
+-- reports stop when the sensor is paused, don't leave stale numbers up
+	expire_image(bg, 75);
+	wnd.tel_msg = bg;
+	return true;
+end
+
 --
 -- Resolve a specific window- coordinate space to the one used locally.
 --
@@ -144,7 +268,7 @@ local function coord_map(wnd, x, y)
 		msg = string.format("ofs@0x%x+%d", bofs, wnd.size_cur);
 
  -- map_tuple, not enough data to map
-	elseif (wnd.map_cur == 1 or wnd.map_cur == 2) then
+	elseif (wnd.map_cur >= 1 and wnd.map_cur <= 3) then
 		msg = string.format("transfer@0x%x %d bytes/pixel",
 			wnd.ofs, wnd.size_cur);
 
@@ -152,12 +276,72 @@ local function coord_map(wnd, x, y)
 		msg = "unknown";
 	end
 
+-- patterns that matched in the last frame
+	if (wnd.ptn_hits and #wnd.ptn_hits > 0) then
+		local sum = 0;
+		local first = wnd.ptn_hits[1].ofs;
+		for i,v in ipairs(wnd.ptn_hits) do
+			sum = sum + v.count;
+			first = math.min(first, v.ofs);
+		end
+		msg = msg .. string.format(" (%d patterns, %d hits, first@0x%x)",
+			#wnd.ptn_hits, sum, wnd.ofs + first);
+	end
+
+-- tap mode, bytes that passed through without being sampled
+	if (wnd.dropped and wnd.dropped > 0) then
+		msg = msg .. string.format(" (%d dropped)", wnd.dropped);
+	end
+
 	return msg;
 end
 
+--
+-- rwstat pattern hit summary, one "ptn:n:" message (and "ptn+:" for the
+-- rest) per frame with id,count,first-offset; entries in hex
+--
+local function pattern_hits(wnd, msg)
+	local total, rest = string.match(msg, "^ptn:(%d+):(.*)");
+	if (total ~= nil) then
+		wnd.ptn_pending = {total = tonumber(total), hits = {}};
+	else
+		rest = string.match(msg, "^ptn%+:(.*)");
+		if (rest == nil) then
+			return false;
+		end
+		if (wnd.ptn_pending == nil) then
+			return true;
+		end
+	end
+
+	local pend = wnd.ptn_pending;
+	for id, cnt, ofs in string.gmatch(rest, "(%x+),(%x+),(%x+);") do
+		table.insert(pend.hits, {id = tonumber(id, 16),
+			count = tonumber(cnt, 16), ofs = tonumber(ofs, 16)});
+	end
+
+	if (#pend.hits >= pend.total) then
+		wnd.ptn_hits = pend.hits;
+		wnd.ptn_pending = nil;
+	end
+	return true;
+end
+
+-- running total of bytes the sensor dropped, "drop:<n>", only sent by
+-- channels that have dropped anything
+local function drop_count(wnd, msg)
+	local n = string.match(msg, "^drop:(%d+)");
+	if (n == nil) then
+		return false;
+	end
+	wnd.dropped = tonumber(n);
+	return true;
+end
+
 local fsrv_ev = {
 	framestatus = function(wnd, source, status)
 		wnd.ofs = status.frame;
+		wnd.ptn_hits = nil;
 		return true; -- don't forward
 	end,
 	streaminfo = function(wnd, source, status)
@@ -173,6 +357,11 @@ local fsrv_ev = {
 				status.width, status.height));
 		end
 		return false; -- forward
+	end,
+	message = function(wnd, source, status)
+		return show_telemetry(wnd, status.message) or
+			pattern_hits(wnd, status.message) or
+			drop_count(wnd, status.message);
 	end
 };
 
@@ -181,12 +370,16 @@ local pop = {{
 	submenu = dpack_sub }, {
 	label = "Metadata...",
 	submenu = alpha_sub }, {
+	label = "Entropy Window...",
+	submenu = entwin_sub }, {
 	label = "Transfer Clock...",
 	submenu = clock_sub }, {
 	label = "Space Mapping...",
 	submenu = space_sub }, {
 	label = "Sample Buffer Size...",
 	submenu = sample_sub }, {
+	label = "Telemetry...",
+	submenu = tel_sub }, {
 	label = "Coloring...",
 	submenu = color_sub }
 };
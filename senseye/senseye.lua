@@ -241,8 +241,17 @@ function default_wh(source, status)
 --		print("window registered:", status.segkind);
 	end
 
-	if (wnd.source_listener and wnd.source_listener[status.kind]) then
-		wnd.source_listener[status.kind](wnd, source, status);
+-- both per-kind handlers (set directly) and sensor listener tables
+	if (wnd.source_listener) then
+		if (wnd.source_listener[status.kind]) then
+			wnd.source_listener[status.kind](wnd, source, status);
+		end
+
+		for k, v in ipairs(wnd.source_listener) do
+			if (v[status.kind]) then
+				v[status.kind](wnd, source, status);
+			end
+		end
 	end
 end
 